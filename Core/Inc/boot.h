@@ -27,13 +27,130 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stdio.h"
 #include "stdint.h"
+/* Typedefs ------------------------------------------------------------------*/
+
+/**
+ * @enum BL_Erase_State_e
+ * @brief State of the interrupt-driven background erase.
+ */
+typedef enum
+{
+	ERASE_IDLE = 0, /**< No background erase has been started */
+	ERASE_BUSY,     /**< Background erase is running */
+	ERASE_DONE,     /**< Last background erase completed successfully */
+	ERASE_ERROR     /**< Last background erase stopped on an error */
+} BL_Erase_State_e;
+
+/**
+ * @struct BL_Erase_Progress_t
+ * @brief Progress of the background erase, updated from the FLASH interrupt.
+ * Reported to the host through TARGET_GET_STATUS reads.
+ */
+typedef struct
+{
+	BL_Erase_State_e state;  /**< Current erase state */
+	uint8_t first_sector;    /**< First sector of the requested range */
+	uint8_t total_sectors;   /**< Number of sectors in the requested range */
+	uint8_t erased_sectors;  /**< Number of sectors erased so far */
+	uint8_t failed_sector;   /**< Sector that caused ERASE_ERROR (0xFF if none) */
+	uint8_t mass_erase;      /**< Non-zero if the request is a mass erase */
+	uint16_t skipped_mask;   /**< Bit n set -> sector n was already blank and not erased */
+} BL_Erase_Progress_t;
+
+/**
+ * @struct BL_Flash_Sector_t
+ * @brief Geometry of one flash sector.
+ */
+typedef struct
+{
+	uint32_t address; /**< Start address of the sector */
+	uint32_t size;    /**< Size of the sector in bytes */
+} BL_Flash_Sector_t;
+
+/**
+ * @struct BL_Diff_Stats_t
+ * @brief Savings of the differential write mode (mem_write_diff()) in this session.
+ */
+typedef struct
+{
+	uint32_t words_skipped;    /**< 4-byte groups not programmed because flash already held the data */
+	uint32_t words_programmed; /**< 4-byte groups programmed */
+	uint16_t erases_avoided;   /**< Sectors written without an erase */
+	uint16_t erases_done;      /**< Sectors erased because a 0->1 bit transition forced it */
+	uint8_t resend_sector;     /**< Sector the host must resend after DIFF_RESEND_SECTOR (0xFF if none) */
+} BL_Diff_Stats_t;
+
+/**
+ * @struct BL_Boot_Time_t
+ * @brief Boot time measured with the DWT cycle counter from the entry of main().
+ */
+typedef struct
+{
+	uint32_t decision_us; /**< main() entry -> boot decision, on the reset clock (the cost of a normal boot) */
+	uint32_t bringup_us;  /**< HAL, clock tree (HSE/PLL) and USB initialisation, only paid in bootloader mode */
+	uint32_t handoff_us;  /**< Teardown of the last boot_handoff(), up to the application reset handler (RTC->BKP5R) */
+} BL_Boot_Time_t;
+
+/**
+ * @struct BL_App_Manifest_t
+ * @brief Manifest the application places right after its vector table (APP_MANIFEST_ADDRESS),
+ * e.g. a const struct in a KEEP(*(.app_manifest)) section following .isr_vector.
+ * image_crc is CRC-32/MPEG-2 over the image_length / 4 words from APP_START_BASE_ADDRESS as
+ * stored in memory (crc32_update_words(): each 4-byte group in reverse order), leaving out
+ * the image_crc word itself; a post-build step pads the image to 4 bytes and fills it in.
+ */
+typedef struct
+{
+	uint32_t magic;        /**< APP_MANIFEST_MAGIC */
+	uint32_t image_length; /**< Bytes from APP_START_BASE_ADDRESS to the end of the image, manifest included, multiple of 4 */
+	uint32_t version;      /**< Application version, reported by STATUS_PAGE_APP_VERSION */
+	uint32_t build_id;     /**< Build identifier (e.g. commit hash), reported by STATUS_PAGE_APP_BUILD_ID */
+	uint32_t image_crc;    /**< CRC of the image without this field */
+} BL_App_Manifest_t;
+
+/**
+ * @enum BL_App_Check_e
+ * @brief Result of the application check (app_image_check()).
+ */
+typedef enum
+{
+	APP_CHECK_OK = 0x00,          /**< Application can be started */
+	APP_CHECK_BAD_VECTORS = 0x01, /**< Stack pointer or reset handler out of range (e.g. erased area) */
+	APP_CHECK_NO_MANIFEST = 0x02, /**< No manifest, or its length does not fit the application area */
+	APP_CHECK_BAD_CRC = 0x03      /**< Image CRC differs from the manifest: incomplete or corrupted image */
+} BL_App_Check_e;
+
 /* External variables --------------------------------------------------------*/
-extern uint8_t buffer_rx[30]; // Note: Consider a more descriptive name like usb_rx_buffer if used globally for USB RX
+extern BL_Boot_Time_t boot_time;
+extern BL_App_Check_e app_check;
+extern uint8_t app_check_warm;
+extern uint32_t app_image_crc;
+extern BL_Diff_Stats_t diff_stats;
+extern const BL_Flash_Sector_t flash_sectors[];
+extern volatile BL_Erase_Progress_t erase_progress; // Updated from the FLASH interrupt
 /* External functions --------------------------------------------------------*/
 extern void address_selection(void); // Consider adding a @brief comment explaining its purpose if complex
 extern void jump_to_user_app(void);
+extern uint8_t app_image_valid(void);
+extern BL_App_Check_e app_image_check(void);
+extern const BL_App_Manifest_t* app_manifest(void);
+extern void warm_boot_invalidate(void);
+extern void boot_timer_start(void);
+extern uint32_t boot_timer_lap(uint32_t core_hz);
+extern void vector_table_relocate(void);
 extern uint8_t mem_write(uint8_t *mem_value, uint32_t mem_address, uint32_t len);
 extern uint8_t flash_erase(uint8_t sector_number , uint8_t number_of_sector);
+extern uint8_t flash_erase_async(uint8_t sector_number, uint8_t number_of_sector);
+extern uint8_t flash_erase_range(uint32_t address, uint32_t len);
+extern void flash_erase_wait(void);
+extern void flash_erase_process(void);
+extern uint8_t flash_get_sector(uint32_t address);
+extern uint8_t flash_check_range(uint32_t address, uint32_t len);
+extern uint8_t flash_region_crc(uint32_t address, uint32_t len, uint32_t *crc);
+extern uint8_t flash_sector_backup(uint8_t sector, uint8_t scratch_sector, uint32_t len);
+extern uint8_t flash_sector_rewrite(uint8_t sector, const uint8_t *data, uint32_t len);
+extern uint8_t flash_erase_on_demand(uint32_t address, uint32_t len);
+extern uint8_t mem_write_diff(const uint8_t *data, uint32_t address, uint32_t len);
 /* Macros and Defines --------------------------------------------------------*/
 
 /**
@@ -52,8 +169,8 @@ extern uint8_t flash_erase(uint8_t sector_number , uint8_t number_of_sector);
 #define F4_SECTOR_7  (0x08060000)   /**< Sector 7 | SIZE: 128 Kbytes */
 #define F4_SECTOR_8  (0x08080000)   /**< Sector 8 | SIZE: 128 Kbytes */
 #define F4_SECTOR_9  (0x080A0000)   /**< Sector 9 | SIZE: 128 Kbytes */
-#define F4_SECTOR_10 (0x08C00000)   /**< Sector 10 | SIZE: 128 Kbytes */
-#define F4_SECTOR_11 (0x08E00000)   /**< Sector 11 | SIZE: 128 Kbytes */
+#define F4_SECTOR_10 (0x080C0000)   /**< Sector 10 | SIZE: 128 Kbytes */
+#define F4_SECTOR_11 (0x080E0000)   /**< Sector 11 | SIZE: 128 Kbytes */
 /** @} */ // End of F4_Flash_Sectors group
 
 /**
@@ -63,8 +180,39 @@ extern uint8_t flash_erase(uint8_t sector_number , uint8_t number_of_sector);
  * Ensure this address corresponds to a valid sector start address.
  */
 #define APP_START_BASE_ADDRESS (F4_SECTOR_2)    /**< User Application Start Address (Sector 2) */
+#define APP_START_SECTOR       (2)              /**< First sector of the user application; lower sectors hold the bootloader */
 
 #define INVALID_SECTOR 0x04                     /**< Error code returned for invalid flash sector operations */
+#define INVALID_SECTOR_NUMBER 0xFF              /**< Sector number returned for addresses outside the flash */
+#define DIFF_RESEND_SECTOR 0x05                 /**< A write erased a sector holding kept or written data; host must resend it */
+#define ERASE_START_HOLD_MS (50U)               /**< Longest wait of a background erase for the host to take its accepted response */
+
+/**
+ * @defgroup RAM_Hotpath Execute-from-RAM Hot Path
+ * @brief While the single-bank flash programs or erases, every instruction fetch
+ * from flash stalls. With BOOT_RAM_HOTPATH defined, the vector table is copied to
+ * SRAM and the flash functions of boot.c and flash_program.c (program, erase, erase
+ * on demand, differential write, region CRC) and the sector tables run from SRAM. The firmware
+ * must then be linked with STM32F407VGTX_FLASH.ld, which places the USB interrupt
+ * path and the whole command path (main loop, parser, process_data, responses,
+ * memcpy/memset) in SRAM too, so USB traffic and status replies keep going during a
+ * background erase. Without BOOT_RAM_HOTPATH, link with STM32F407VGTX_FLASH_XIP.ld,
+ * which runs everything from flash. Each script fails the link when used with the
+ * other setting.
+ * @{
+ */
+#define BOOT_RAM_HOTPATH    /**< Comment out to execute from flash (and link with STM32F407VGTX_FLASH_XIP.ld) */
+
+#ifdef BOOT_RAM_HOTPATH
+	#define BOOT_RAM_FUNC __attribute__((section(".RamFunc")))        /**< Places a function in SRAM (copied by the startup code) */
+	#define BOOT_RAM_CONST __attribute__((section(".data.ram_const"))) /**< Places a constant table in SRAM (copied by the startup code) */
+#else
+	#define BOOT_RAM_FUNC
+	#define BOOT_RAM_CONST
+#endif
+
+#define VECTOR_TABLE_WORDS (16 + 82)    /**< Cortex-M4 system exceptions + STM32F407 peripheral interrupts */
+/** @} */ // End of RAM_Hotpath group
 
 /**
  * @defgroup MCU_Selection Target MCU Definition
@@ -76,14 +224,54 @@ extern uint8_t flash_erase(uint8_t sector_number , uint8_t number_of_sector);
 //#define STM32F407VETx     /**< Define for STM32F407VE with 512Kbytes Flash Memory */
 
 #ifdef STM32F407VGTx
-	#define TOTAL_SECTORS (11)    /**< Total number of sectors for 1Mbyte Flash (0-11) */
+	#define TOTAL_SECTORS (12)           /**< Total number of sectors for 1Mbyte Flash (0-11) */
+	#define FLASH_TOTAL_SIZE (0x100000)  /**< 1 Mbyte */
 #elif defined(STM32F407VETx)
-	#define TOTAL_SECTORS (7)     /**< Total number of sectors for 512Kbyte Flash (0-7) */
+	#define TOTAL_SECTORS (8)            /**< Total number of sectors for 512Kbyte Flash (0-7) */
+	#define FLASH_TOTAL_SIZE (0x80000)   /**< 512 Kbytes */
 #else
-	#define TOTAL_SECTORS (7)     /**< Default Total number of sectors */
+	#define TOTAL_SECTORS (8)            /**< Default Total number of sectors */
+	#define FLASH_TOTAL_SIZE (0x80000)   /**< Default flash size */
 #endif
+
+#define FLASH_LOOKUP_SHIFT (14)      /**< Address -> sector lookup granule: 16 Kbytes, the smallest sector */
+#define APP_AREA_SIZE (F4_SECTOR_0 + FLASH_TOTAL_SIZE - APP_START_BASE_ADDRESS) /**< Bytes from the application start to the end of the flash */
+#define APP_SRAM_SIZE (0x20000)      /**< SRAM1 + SRAM2, valid range of the application stack pointer */
+#define APP_CCMRAM_SIZE (0x10000)    /**< CCM RAM, also accepted as stack */
+#define AHB1ENR_RESET_VALUE (RCC_AHB1ENR_CCMDATARAMEN) /**< RCC->AHB1ENR after reset: only the CCM RAM clock */
 /** @} */ // End of MCU_Selection group
 
+/**
+ * @defgroup App_Manifest Application Image Manifest
+ * @brief The manifest (BL_App_Manifest_t) gives the real length of the application, so
+ * the boot check only checksums the image instead of the whole application area.
+ * @{
+ */
+#define APP_MANIFEST_REQUIRED    /**< Comment out to also start applications without a manifest (vector check only) */
+
+#define APP_MANIFEST_ADDRESS (APP_START_BASE_ADDRESS + VECTOR_TABLE_WORDS * 4) /**< Right after the application vector table */
+#define APP_MANIFEST_MAGIC (0x4D414E46UL) /**< "MANF" */
+/** @} */ // End of App_Manifest group
+
+/**
+ * @defgroup Warm_Boot Warm-Boot Validation Record
+ * @brief After a successful app_image_check(), the manifest digest and the flash write
+ * generation are kept in RTC backup registers, which survive every reset but a power-on
+ * without VBAT. While the record matches, the boot check skips the image CRC. Any flash
+ * erase or write increments the generation and so invalidates the record.
+ * @{
+ */
+#define WARM_BOOT_RECORD    /**< Comment out to checksum the image on every reset */
+
+#define WARM_BOOT_MAGIC (0x57424F54UL) /**< "WBOT", record present */
+#define WARM_BOOT_BKP_MAGIC      (0)   /**< RTC->BKP0R: WARM_BOOT_MAGIC */
+#define WARM_BOOT_BKP_DIGEST     (1)   /**< RTC->BKP1R: image_crc of the validated manifest */
+#define WARM_BOOT_BKP_LENGTH     (2)   /**< RTC->BKP2R: image_length of the validated manifest */
+#define WARM_BOOT_BKP_GENERATION (3)   /**< RTC->BKP3R: flash write generation when the image was validated */
+#define WARM_BOOT_BKP_FLASH_GEN  (4)   /**< RTC->BKP4R: current flash write generation */
+#define WARM_BOOT_BKP_HANDOFF    (5)   /**< RTC->BKP5R: boot_time.handoff_us of the last handoff, not part of the record */
+/** @} */ // End of Warm_Boot group
+
 
 #endif /* INC_BOOT_H_ */
 
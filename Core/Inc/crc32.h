@@ -0,0 +1,51 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : crc32.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for crc32.c file.
+ *
+ * @description    : CRC-32/MPEG-2 service (polynomial 0x04C11DB7, initial
+ *                   value 0xFFFFFFFF, no reflection, no final XOR) over byte
+ *                   buffers. Computed by the STM32 CRC unit when it exists,
+ *                   otherwise by a bit-exact software implementation.
+ *                   crc32_update_words() covers 32-bit words in memory order
+ *                   instead and is fed to the unit by DMA (application image).
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_CRC32_H_
+#define INC_CRC32_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/** @brief Initial value of a CRC-32/MPEG-2 computation. */
+#define CRC32_INIT (0xFFFFFFFFUL)
+
+/** @brief CRC-32/MPEG-2 polynomial, also used by the STM32 CRC unit. */
+#define CRC32_POLYNOMIAL (0x04C11DB7UL)
+
+/** @brief Largest number of words one DMA transfer can move (NDTR is 16 bits). */
+#define CRC32_DMA_CHUNK_WORDS (0xFFFFUL)
+
+/* External functions --------------------------------------------------------*/
+extern void crc32_init(void);
+extern uint32_t crc32_compute(const uint8_t *data, uint32_t len);
+extern uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+extern uint32_t crc32_update_sw(uint32_t crc, const uint8_t *data, uint32_t len);
+extern uint32_t crc32_update_words(uint32_t crc, const uint32_t *data, uint32_t words);
+
+#endif /* INC_CRC32_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
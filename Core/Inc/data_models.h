@@ -43,6 +43,24 @@
 /** @brief End byte identifying the finishing of a response message from the bootloader. */
 #define BOOTLOADER_RESP_END_BYTE (0x25) // End of Frame (EOF) for device->host responses
 
+/** @brief Length of a fixed frame with a 4-byte payload (every response and most commands). */
+#define BL_FRAME_LENGTH (15)
+
+/** @brief Header length of a bulk frame (DATA_TYPE_BYTE_ARRAY): start byte ... data_type + 2-byte data_length. */
+#define BL_BULK_HEADER_LENGTH (12)
+
+/** @brief Largest payload of a bulk frame in bytes. */
+#define BL_BULK_PAYLOAD_MAX (1024)
+
+/** @brief Largest frame the parser accepts: bulk header + payload + end byte. */
+#define BL_FRAME_MAX_LENGTH (BL_BULK_HEADER_LENGTH + BL_BULK_PAYLOAD_MAX + 1)
+
+/** @brief Responses a single command can produce in ack mode: pending ack, sequence NACK, own response. */
+#define BL_RESPONSE_FRAMES_MAX (3)
+
+/** @brief Number of parsed commands that can wait for processing (reported by STATUS_PAGE_QUEUE). */
+#define BL_MESSAGE_QUEUE_SIZE (4)
+
 
 
 /**
@@ -58,8 +76,15 @@ typedef enum
 	TARGET_CHIP_RESET  = 0x04,/**< Command targets the Chip Reset function */
 	TARGET_GET_STATUS  = 0x05,/**< Command targets retrieving device status (Example) */
 	// Add other specific targets/commands as needed
-	UNIT_ADDRESS_6 = 0x06,/**< UNIT_ADDRESS_6 */
-	UNIT_ADDRESS_7 = 0x08,/**< UNIT_ADDRESS_7 */
+	TARGET_MEM_FLUSH   = 0x06,/**< Command flushes the write-combining buffer into flash */
+	TARGET_SESSION_OPTION = 0x07,/**< Reads/writes a session option (address -> BL_Session_Option_e, data -> value) */
+	TARGET_ERASE_RANGE = 0x08,/**< Erases the sectors covering a byte range (address -> start, data -> length) */
+	TARGET_ACK         = 0x09,/**< Cumulative acknowledgement sent by the device in ack mode (OPTION_ACK_MODE) */
+	TARGET_FLASH_CRC   = 0x0A,/**< READ: CRC-32 of a flash region (address -> start, data -> length); response data -> CRC */
+	TARGET_LZ4_START   = 0x0B,/**< Starts a compressed write (address -> destination, data -> decompressed length) */
+	TARGET_LZ4_DATA    = 0x0C,/**< Next part of the compressed stream (address -> stream offset); response data[2..3] -> blocks done */
+	TARGET_PATCH_START = 0x0D,/**< Bulk: starts a delta patch of the application (payload -> old/new length and CRC-32) */
+	TARGET_PATCH_DATA  = 0x0E,/**< Next part of the patch stream (address -> stream offset); response data[2..3] -> sectors started */
 	TARGET_INVALID     = 0xFF /**< Indicates an invalid or unsupported target */
 } Device_Command_Target_e;
 
@@ -91,10 +116,62 @@ typedef enum
 	BL_ERR_INVALID_FORMAT,  /**< General message format error (e.g., field missing, incorrect length) */
 	BL_ERR_FLASH_ERASE,     /**< Error during flash erase operation */
 	BL_ERR_FLASH_WRITE,     /**< Error during flash write operation */
-	BL_ERR_TIMEOUT          /**< Communication timeout occurred */
+	BL_ERR_TIMEOUT,         /**< Communication timeout occurred */
+	BL_ERR_FLASH_BUSY,      /**< A background flash erase is still running */
+	BL_ERR_DIFF_RESEND,     /**< A write had to erase a sector holding data of this session; resend it from its start (sector in data[1]) */
+	BL_ERR_SEQUENCE,        /**< Ack mode: command numbers are missing, from command_number on (count in data[2..3]) */
+	BL_ERR_CRC,             /**< LINK_MODE_COBS_CRC32: a frame had an invalid encoding or CRC and was dropped */
+	BL_ERR_DECOMPRESS,      /**< Compressed stream is malformed or was not started; restart it with TARGET_LZ4_START */
+	BL_ERR_PATCH,           /**< Delta patch failed (data[1]: 0 malformed, 1 old image differs, 2 new image CRC mismatch) */
+	BL_ERR_NO_MANIFEST      /**< The application in flash has no valid manifest */
 	// Add other specific error codes as needed
 }BL_Error_Handler_e;
 
+/**
+ * @enum BL_Session_Option_e
+ * @brief Session options selected by the address field of TARGET_SESSION_OPTION.
+ */
+typedef enum
+{
+	OPTION_DIFF_WRITE = 0x01, /**< data[0] != 0 -> differential writes (only changed data is erased/programmed) */
+	OPTION_ACK_MODE = 0x02,   /**< data[0] != 0 -> cumulative acks every data[1] commands or data[2..3] ms (0 -> default) */
+	OPTION_LINK_MODE = 0x03   /**< data[0] -> BL_Link_Mode_e; a read returns the supported modes as a bit mask in data[1] */
+} BL_Session_Option_e;
+
+/**
+ * @enum BL_Link_Mode_e
+ * @brief Framing of the frames on the USB byte stream (see link.h).
+ */
+typedef enum
+{
+	LINK_MODE_RAW = 0x00,        /**< Frames as they are, delimited by start byte, length and end byte */
+	LINK_MODE_COBS_CRC32 = 0x01  /**< Frame + CRC-32, COBS encoded, terminated by 0x00 */
+} BL_Link_Mode_e;
+
+/**
+ * @enum BL_Status_Page_e
+ * @brief Status pages selected by the address field of a TARGET_GET_STATUS read.
+ */
+typedef enum
+{
+	STATUS_PAGE_ERASE = 0x00,           /**< [state][erased sectors][total sectors][failed sector] */
+	STATUS_PAGE_DIFF_SKIPPED = 0x01,    /**< u32 -> 4-byte groups skipped by the differential write */
+	STATUS_PAGE_DIFF_PROGRAMMED = 0x02, /**< u32 -> 4-byte groups programmed by the differential write */
+	STATUS_PAGE_DIFF_ERASES = 0x03,     /**< [erases avoided u16][erases done u16] of the differential write */
+	STATUS_PAGE_QUEUE = 0x04,           /**< [queued commands][queue capacity][free receive bytes u16] */
+	STATUS_PAGE_IMAGE_CRC = 0x05,       /**< u32 -> image CRC of the application found by the last application check */
+	STATUS_PAGE_DECOMPRESS = 0x06,      /**< [BL_Decompress_State_e][0][blocks done u16] of the compressed write */
+	STATUS_PAGE_DECOMPRESS_OFFSET = 0x07, /**< u32 -> compressed bytes consumed (next expected stream offset) */
+	STATUS_PAGE_PATCH = 0x08,           /**< [BL_Patch_State_e][sector being rebuilt][sectors started u16] of the delta patch */
+	STATUS_PAGE_PATCH_OFFSET = 0x09,    /**< u32 -> patch bytes consumed (next expected stream offset) */
+	STATUS_PAGE_BOOT_DECISION = 0x0A,   /**< u32 -> us from main() entry to the boot decision (normal boot cost) */
+	STATUS_PAGE_BOOT_BRINGUP = 0x0B,    /**< u32 -> us of HAL, clock and USB bring-up, skipped by a normal boot */
+	STATUS_PAGE_APP_CHECK = 0x0C,       /**< u32 -> BL_App_Check_e of the application check at boot, bit 8 set if taken from the warm-boot record */
+	STATUS_PAGE_APP_VERSION = 0x0D,     /**< u32 -> version from the application manifest */
+	STATUS_PAGE_APP_BUILD_ID = 0x0E,    /**< u32 -> build ID from the application manifest */
+	STATUS_PAGE_BOOT_HANDOFF = 0x0F     /**< u32 -> us of the handoff before the last reset (RTC->BKP5R) */
+} BL_Status_Page_e;
+
 /**
  * @enum BL_Device_Comm_Status_e
  * @brief Represents the communication status with the host.
@@ -131,7 +208,7 @@ typedef enum
 	DATA_TYPE_I32,        /**< Signed 32-bit integer (4 bytes) */
 	DATA_TYPE_U32,        /**< Unsigned 32-bit integer (4 bytes) */
 	DATA_TYPE_FLOAT,      /**< Single-precision float (4 bytes) */
-	DATA_TYPE_BYTE_ARRAY  /**< Raw byte array (length may vary or be implicit) */
+	DATA_TYPE_BYTE_ARRAY  /**< Raw byte array. In a host command: bulk frame, data_length bytes follow the header */
 } BL_Data_Type_e;
 
 
@@ -201,6 +278,8 @@ typedef struct
 	BL_Message_State_e message_state;     /**< Current state of the incoming message parser */
 	BL_Error_Handler_e last_error;        /**< Stores the code of the last error that occurred */
 	uint32_t error_counter;               /**< Counter for the total number of errors detected */
+	uint8_t error_info;                   /**< Additional error information sent in data[1] of the error response */
+	uint32_t error_address;               /**< Flash address sent in the address field of the error response (0 -> TARGET_INVALID) */
 
 } BL_Device_t;
 
@@ -225,10 +304,11 @@ typedef struct
 	models_u32_u address;         /**< Memory address or parameter associated with the command (e.g., flash address to write/erase) - Replaces command_address */
 	BL_Command_Type_e command_type; /**< Type of the command (READ, WRITE, RESPONSE) */
 	BL_Data_Type_e data_type;       /**< Type of the data in the payload */
-	uint16_t data_length;           /**< Length of the data payload in bytes (can be implicit for fixed-size types) - EKLENDİ */
+	uint16_t data_length;           /**< Length of the data payload in bytes (4 for fixed frames) */
 
 	// --- Payload ---
 	BL_Data_u data;                 /**< Data payload union (access member based on data_type) */
+	const uint8_t *payload;         /**< data_length payload bytes: data.b for fixed frames, the receive buffer for bulk frames */
 
 	// --- Footer/Checksum (in the features) ---
 	// uint8_t checksum;            // Example: Add checksum for integrity
@@ -28,6 +28,14 @@ extern uint8_t process_data(void);
 extern void handle_error(BL_Error_Handler_e err);
 extern uint8_t read_process_data(uint32_t cmd_adress);
 extern uint8_t write_process_data(uint32_t unit_adress);
+extern uint8_t read_status(uint32_t page);
+extern uint8_t read_session_option(uint32_t option);
+extern uint8_t read_flash_crc(uint32_t address, uint32_t len);
+extern uint8_t write_session_option(uint32_t option);
+extern uint8_t write_status_to_error(uint8_t status);
+extern uint8_t erase_status_to_error(uint8_t status);
+extern uint8_t flush_status_to_error(void);
+extern void ack_process(void);
 extern uint8_t f_value_func(uint8_t cmd_type, uint8_t data_type, BL_Data_u data);
 
 
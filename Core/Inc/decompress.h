@@ -0,0 +1,76 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : decompress.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for decompress.c file.
+ *
+ * @description    : Streaming LZ4 decompressor placed between the parser and
+ *                   the write-combining buffer. The host sends a compressed
+ *                   stream in frames of any size; it is decoded as it arrives
+ *                   through a bounded RAM window and the output is programmed
+ *                   from the start address on.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_DECOMPRESS_H_
+#define INC_DECOMPRESS_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/**
+ * @def DECOMPRESS_WINDOW_SIZE
+ * @brief History kept for LZ4 matches in bytes. Must be a power of two.
+ * The host compressor must not emit match offsets above it (LZ4_DISTANCE_MAX).
+ */
+#define DECOMPRESS_WINDOW_SIZE (4096)
+
+/** @brief Block header: compressed length u16 + decompressed length u16 (little endian). */
+#define DECOMPRESS_BLOCK_HEADER_LENGTH (4)
+
+#define DECOMPRESS_INVALID_DATA (0x06)  /**< Malformed stream, or data before decompress_start() */
+#define DECOMPRESS_OUT_OF_ORDER (0x07)  /**< Stream offset leaves a gap after the consumed bytes */
+
+/**
+ * @enum BL_Decompress_State_e
+ * @brief State of the compressed-write stream (STATUS_PAGE_DECOMPRESS).
+ */
+typedef enum BL_Decompress_State_e {
+	DECOMPRESS_IDLE = 0x00,     /**< No stream started */
+	DECOMPRESS_RUNNING = 0x01,  /**< Waiting for more compressed data */
+	DECOMPRESS_DONE = 0x02,     /**< Whole output decoded and programmed */
+	DECOMPRESS_ERROR = 0x03     /**< Stream aborted; restart with decompress_start() */
+} BL_Decompress_State_e;
+
+/**
+ * @struct BL_Decompress_Progress_t
+ * @brief Progress of the current compressed-write stream.
+ */
+typedef struct BL_Decompress_Progress_t {
+	BL_Decompress_State_e state; /**< BL_Decompress_State_e */
+	uint16_t blocks;             /**< Blocks completely decoded */
+	uint32_t consumed;           /**< Compressed bytes consumed (next expected stream offset) */
+	uint32_t produced;           /**< Decompressed bytes produced */
+} BL_Decompress_Progress_t;
+
+/* External variables --------------------------------------------------------*/
+extern BL_Decompress_Progress_t decompress_progress;
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t decompress_start(uint32_t address, uint32_t len);
+extern uint8_t decompress_feed(const uint8_t *data, uint32_t offset, uint32_t len);
+
+#endif /* INC_DECOMPRESS_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,34 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : flash_program.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for flash_program.c file.
+ *
+ * @description    : Alignment-aware flash programming engine used by
+ *                   mem_write() and mem_write_diff(). Kept apart from boot.c
+ *                   so that Tools/flash_program builds it on the host against
+ *                   a simulated FLASH register block.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_FLASH_PROGRAM_H_
+#define INC_FLASH_PROGRAM_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t flash_program(const uint8_t *data, uint32_t address, uint32_t len);
+
+#endif /* INC_FLASH_PROGRAM_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
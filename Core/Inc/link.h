@@ -0,0 +1,60 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : link.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for link.c file.
+ *
+ * @description    : Link layer between the USB byte stream and the frames of
+ *                   data_models.h. In LINK_MODE_RAW frames are sent as they
+ *                   are; in LINK_MODE_COBS_CRC32 each frame is followed by its
+ *                   CRC-32, COBS encoded and terminated by a 0x00 delimiter.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_LINK_H_
+#define INC_LINK_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "data_models.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/** @brief Length of the CRC-32 appended to a frame in LINK_MODE_COBS_CRC32. */
+#define LINK_CRC_LENGTH (4)
+
+/** @brief COBS delimiter that terminates every encoded frame. */
+#define LINK_DELIMITER (0x00)
+
+/** @brief Encoded length of a frame of n bytes: CRC, one code byte per 254 bytes, delimiter. */
+#define LINK_ENCODED_LENGTH(n) ((n) + LINK_CRC_LENGTH + ((n) + LINK_CRC_LENGTH) / 254 + 2)
+
+/** @brief Largest encoded frame the receiver accepts. */
+#define LINK_FRAME_MAX_LENGTH LINK_ENCODED_LENGTH(BL_FRAME_MAX_LENGTH)
+
+/** @brief Largest encoded response (responses are BL_FRAME_LENGTH bytes). */
+#define LINK_RESPONSE_MAX_LENGTH LINK_ENCODED_LENGTH(BL_FRAME_LENGTH)
+
+/** @brief Link modes supported by this bootloader (bit n -> BL_Link_Mode_e n). */
+#define LINK_CAPABILITIES ((1U << LINK_MODE_RAW) | (1U << LINK_MODE_COBS_CRC32))
+
+/* External functions --------------------------------------------------------*/
+extern BL_Link_Mode_e link_get_mode(void);
+extern uint8_t link_set_mode(uint8_t mode);
+extern void link_update(void);
+extern void link_reset(void);
+extern uint8_t link_send(const uint8_t *frame, uint16_t len);
+extern uint16_t link_decode(uint8_t *buff, uint16_t len);
+
+#endif /* INC_LINK_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -28,7 +28,14 @@
 #include <stdbool.h>
 #include "data_models.h" // Include protocol definitions
 /* Function Prototypes -------------------------------------------------------*/
-void parse_message(uint8_t* raw_buff,uint8_t len);
+void stream_process(void);
+void parser_reset(void);
+uint16_t stream_free_space(void);
+bool message_queue_pop(void);
+void message_queue_release(void);
+uint8_t message_queue_depth(void);
+uint32_t frame_length(const uint8_t* buff, uint16_t len);
+void parse_message(uint8_t* raw_buff,uint16_t len);
 void pre_process_message(uint8_t* buff);
 
 #endif /* INC_PARSER_H_ */
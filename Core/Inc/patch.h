@@ -0,0 +1,91 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : patch.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for patch.c file.
+ *
+ * @description    : Applies a binary delta patch to the application at
+ *                   APP_START_BASE_ADDRESS. The host sends a stream of copy
+ *                   and insert operations computed against the resident
+ *                   image; the new image is rebuilt in place, sector by
+ *                   sector, with the old content of the sector being rewritten
+ *                   kept in PATCH_SCRATCH_SECTOR.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_PATCH_H_
+#define INC_PATCH_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+#include "boot.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/**
+ * @def PATCH_SCRATCH_SECTOR
+ * @brief Sector that holds the old content of the sector being rebuilt. Old and new
+ * images must end before it, so an application that uses it cannot be patched.
+ */
+#define PATCH_SCRATCH_SECTOR (TOTAL_SECTORS - 1)
+
+/**
+ * @def PATCH_STAGE_SIZE
+ * @brief Sectors up to this size (the 16 and 64 Kbyte sectors) are rebuilt in a RAM
+ * buffer in CCM RAM and need no scratch copy. Larger sectors are rebuilt in place.
+ */
+#define PATCH_STAGE_SIZE (0x10000)
+
+/** @brief Length of the TARGET_PATCH_START payload: old length, old CRC, new length, new CRC (u32 each). */
+#define PATCH_HEADER_LENGTH (16)
+
+#define PATCH_OP_COPY   (0x01) /**< [old offset u32][length u32]: copy bytes of the old image */
+#define PATCH_OP_INSERT (0x02) /**< [length u32][bytes]: insert new bytes */
+
+#define PATCH_INVALID_DATA (0x08)  /**< Malformed patch, or data before patch_start() */
+#define PATCH_OUT_OF_ORDER (0x09)  /**< Stream offset leaves a gap after the consumed bytes */
+#define PATCH_OLD_DIGEST   (0x0A)  /**< Resident image does not match the patch base */
+#define PATCH_NEW_DIGEST   (0x0B)  /**< Rebuilt image does not match the expected CRC */
+
+/**
+ * @enum BL_Patch_State_e
+ * @brief State of the patch (STATUS_PAGE_PATCH).
+ */
+typedef enum BL_Patch_State_e {
+	PATCH_IDLE = 0x00,     /**< No patch started */
+	PATCH_RUNNING = 0x01,  /**< Waiting for more patch data */
+	PATCH_DONE = 0x02,     /**< New image rebuilt and verified */
+	PATCH_ERROR = 0x03     /**< Patch aborted; the application may be incomplete */
+} BL_Patch_State_e;
+
+/**
+ * @struct BL_Patch_Progress_t
+ * @brief Progress of the current patch.
+ */
+typedef struct BL_Patch_Progress_t {
+	BL_Patch_State_e state;  /**< BL_Patch_State_e */
+	uint8_t sector;          /**< Sector being rebuilt (INVALID_SECTOR_NUMBER before the first one) */
+	uint16_t sectors;        /**< Sectors started (backed up and erased only when their content changes) */
+	uint32_t consumed;       /**< Patch bytes consumed (next expected stream offset) */
+	uint32_t produced;       /**< New image bytes written */
+} BL_Patch_Progress_t;
+
+/* External variables --------------------------------------------------------*/
+extern BL_Patch_Progress_t patch_progress;
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t patch_start(const uint8_t *header, uint32_t len);
+extern uint8_t patch_feed(const uint8_t *data, uint32_t offset, uint32_t len);
+
+#endif /* INC_PATCH_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,53 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : response_cache.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for response_cache.c file.
+ *
+ * @description    : Remembers the results of the last WRITE commands by
+ *                   command_number and payload digest, so that a command the
+ *                   host retransmits is answered again without being executed
+ *                   a second time.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_RESPONSE_CACHE_H_
+#define INC_RESPONSE_CACHE_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/**
+ * @def RESPONSE_CACHE_SIZE
+ * @brief Number of WRITE results kept for retransmissions. The oldest one is replaced.
+ * Must cover the commands the host may have in flight when it retransmits.
+ */
+#define RESPONSE_CACHE_SIZE (8)
+
+/**
+ * @def RESPONSE_CACHE_WINDOW
+ * @brief Only commands at most this many numbers behind the newest WRITE command are
+ * replayed. A command further behind, or command_number 0, means the host restarted
+ * its numbering; the cache is reset and the command is executed.
+ */
+#define RESPONSE_CACHE_WINDOW (RESPONSE_CACHE_SIZE)
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t response_cache_replay(uint8_t *err);
+extern void response_cache_store(uint8_t err);
+extern void response_cache_reset(void);
+
+#endif /* INC_RESPONSE_CACHE_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
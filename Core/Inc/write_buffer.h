@@ -0,0 +1,48 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : write_buffer.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Header for write_buffer.c file.
+ *
+ * @description    : RAM write-combining buffer placed in front of the flash
+ *                   programmer. Consecutive TARGET_MEM_WRITE payloads are
+ *                   collected into aligned lines and programmed in one
+ *                   unlock/program/lock pass.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 ÖMER FARUK ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ *
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_WRITE_BUFFER_H_
+#define INC_WRITE_BUFFER_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+
+/**
+ * @def WRITE_BUFFER_LINE_SIZE
+ * @brief Size of one write-combining line in bytes. Must be a power of two.
+ * A line is flushed when it fills, when a write is not contiguous with the
+ * buffered data, or when write_buffer_flush() is called explicitly.
+ */
+#define WRITE_BUFFER_LINE_SIZE (256)
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t write_buffer_write(const uint8_t *data, uint32_t address, uint32_t len);
+extern uint8_t write_buffer_flush(void);
+extern void write_buffer_set_diff_mode(uint8_t enable);
+extern uint8_t write_buffer_get_diff_mode(void);
+extern uint32_t write_buffer_failed_address(void);
+
+#endif /* INC_WRITE_BUFFER_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -21,27 +21,411 @@
 /* Includes ------------------------------------------------------------------*/
 #include "boot.h"
 #include "main.h" // For HAL_Delay, HAL types
+#include "crc32.h"
+#include "usbd_core.h" // For USBD_DeInit
+#include "usbd_cdc_if.h" // For CDC_TxIdle_FS
+#include "response_cache.h"
+#include "flash_program.h"
 /* Variables -----------------------------------------------------------------*/
-uint8_t buffer_rx[30];
+#ifdef BOOT_RAM_HOTPATH
+uint32_t ram_vector_table[VECTOR_TABLE_WORDS] __attribute__((section(".ram_vector"), aligned(512)));
+#endif
+volatile BL_Erase_Progress_t erase_progress = { .state = ERASE_IDLE, .failed_sector = INVALID_SECTOR_NUMBER };
+static volatile uint16_t sector_erased_mask = 0; // Bit n set -> sector n has been erased in this session and is still blank
+static volatile uint16_t sector_written_mask = 0; // Bit n set -> sector n was programmed since its erase in this session
+static volatile uint16_t erase_pending_mask = 0; // Bit n set -> sector n is still queued for the current erase
+static volatile uint8_t erase_running_sector = INVALID_SECTOR_NUMBER; // Sector being erased in the background
+static uint8_t erase_start_held = 0;             // 1 -> the background erase waits for its accepted response to leave
+static uint32_t erase_accept_tick = 0;           // HAL_GetTick() when the background erase was accepted
+static uint16_t diff_kept_mask = 0;              // Bit n set -> sector n kept old content during a differential write
+BL_Diff_Stats_t diff_stats = { .resend_sector = INVALID_SECTOR_NUMBER };
+BL_Boot_Time_t boot_time = { 0 };
+BL_App_Check_e app_check = APP_CHECK_BAD_VECTORS; // Result of the application check at boot
+uint8_t app_check_warm = 0; // 1 if app_check was taken from the warm-boot record
+uint32_t app_image_crc = 0; // Image CRC found by the last app_image_check(), valid in APP_CHECK_OK/BAD_CRC
+static uint8_t warm_boot_invalidated = 0; // Flash generation already advanced in this session
+static uint32_t boot_timer_last = 0; // DWT->CYCCNT at the last boot_timer_lap()
+extern USBD_HandleTypeDef hUsbDeviceFS; // Defined in usb_device.c, pData is set once the stack is initialised
+
+/** Flash geometry of the selected MCU (see MCU_Selection in boot.h). */
+BOOT_RAM_CONST const BL_Flash_Sector_t flash_sectors[TOTAL_SECTORS] = {
+	{ F4_SECTOR_0,  0x4000 },  // 16 Kbytes
+	{ F4_SECTOR_1,  0x4000 },  // 16 Kbytes
+	{ F4_SECTOR_2,  0x4000 },  // 16 Kbytes
+	{ F4_SECTOR_3,  0x4000 },  // 16 Kbytes
+	{ F4_SECTOR_4,  0x10000 }, // 64 Kbytes
+	{ F4_SECTOR_5,  0x20000 }, // 128 Kbytes
+	{ F4_SECTOR_6,  0x20000 }, // 128 Kbytes
+	{ F4_SECTOR_7,  0x20000 }, // 128 Kbytes
+#if (TOTAL_SECTORS > 8)
+	{ F4_SECTOR_8,  0x20000 }, // 128 Kbytes
+	{ F4_SECTOR_9,  0x20000 }, // 128 Kbytes
+	{ F4_SECTOR_10, 0x20000 }, // 128 Kbytes
+	{ F4_SECTOR_11, 0x20000 }, // 128 Kbytes
+#endif
+};
+
+/** Sector number of every 16 Kbytes granule of the flash, for O(1) address -> sector lookup. */
+BOOT_RAM_CONST static const uint8_t flash_sector_lookup[FLASH_TOTAL_SIZE >> FLASH_LOOKUP_SHIFT] = {
+	[0] = 0, [1] = 1, [2] = 2, [3] = 3,
+	[4 ... 7] = 4,
+	[8 ... 15] = 5,
+	[16 ... 23] = 6,
+	[24 ... 31] = 7,
+#if (TOTAL_SECTORS > 8)
+	[32 ... 39] = 8,
+	[40 ... 47] = 9,
+	[48 ... 55] = 10,
+	[56 ... 63] = 11,
+#endif
+};
 /* Prototypes ----------------------------------------------------------------*/
 void jump_to_user_app(void);
 void address_selection(void);
+uint8_t app_image_valid(void);
+BL_App_Check_e app_image_check(void);
+const BL_App_Manifest_t* app_manifest(void);
+void warm_boot_invalidate(void);
+void boot_timer_start(void);
+uint32_t boot_timer_lap(uint32_t core_hz);
+void vector_table_relocate(void);
+uint8_t flash_erase_async(uint8_t sector_number, uint8_t number_of_sector);
+uint8_t flash_erase_range(uint32_t address, uint32_t len);
+void flash_erase_wait(void);
+void flash_erase_process(void);
+uint8_t flash_get_sector(uint32_t address);
+uint8_t flash_erase_on_demand(uint32_t address, uint32_t len);
+uint8_t mem_write_diff(const uint8_t *data, uint32_t address, uint32_t len);
+uint8_t flash_check_range(uint32_t address, uint32_t len);
+uint8_t flash_region_crc(uint32_t address, uint32_t len, uint32_t *crc);
+uint8_t flash_sector_backup(uint8_t sector, uint8_t scratch_sector, uint32_t len);
+uint8_t flash_sector_rewrite(uint8_t sector, const uint8_t *data, uint32_t len);
+static void flash_data_cache_reset(void);
+static void boot_handoff(void);
+static uint8_t warm_boot_match(void);
+static void warm_boot_store(void);
+static volatile uint32_t* warm_boot_register(uint32_t index);
+static void flash_unlock(void);
+static void flash_mark_written(uint32_t address, uint32_t len);
+static uint8_t flash_range_is_blank(uint32_t address, uint32_t len);
 /* Functions -----------------------------------------------------------------*/
 
 /**
  * @fn void address_selection(void)
- * @brief When the program starts, if the defined Button state is closed circuit (i.e., pressed),
- * 			it remains in the bootloader area; otherwise, it jumps to the application area.
+ * @brief Boot decision, taken before HAL_Init() on the reset clock (HSI): if the defined
+ * 			Button state is closed circuit (i.e., pressed) or the application fails
+ * 			app_image_check(), it remains in the bootloader area; otherwise, it jumps to the
+ * 			application area.
+ * 			Only the button port clock is enabled, so a normal boot does not pay for the
+ * 			PLL lock and the USB stack, which the application configures itself anyway.
  *
- * @pre program is run for the first time or MCU is reset.
- * @post stays in the bootloader area if the button is pressed, otherwise switches to the application area.
+ * @pre program is run for the first time or MCU is reset. Called first in main().
+ * @post stays in the bootloader area if the button is pressed or the application is
+ * 		 invalid, otherwise switches to the application area. boot_time.decision_us,
+ * 		 app_check and app_check_warm are set; in the bootloader, boot_time.handoff_us
+ * 		 holds the previous handoff.
  */
 void address_selection(void) {
-	if (HAL_GPIO_ReadPin(BUTTON_GPIO_Port, BUTTON_Pin)) {
-		HAL_GPIO_TogglePin(LED3_GPIO_Port, LED3_Pin);
+	boot_timer_start();
+
+	__HAL_RCC_GPIOA_CLK_ENABLE(); // BUTTON_GPIO_Port; the pin is an input without pull after reset
+	uint8_t pressed = (HAL_GPIO_ReadPin(BUTTON_GPIO_Port, BUTTON_Pin) == GPIO_PIN_SET);
+	crc32_init();
+	if (warm_boot_match()) {
+		app_check = APP_CHECK_OK; // Validated before and no flash write since
+		app_check_warm = 1;
+		app_image_crc = app_manifest()->image_crc;
 	} else {
+		app_check = app_image_check();
+		if (app_check == APP_CHECK_OK) {
+			warm_boot_store();
+		}
+	}
+#ifdef APP_MANIFEST_REQUIRED
+	uint8_t valid = (app_check == APP_CHECK_OK);
+#else
+	uint8_t valid = (app_check == APP_CHECK_OK) || (app_check == APP_CHECK_NO_MANIFEST);
+#endif
+
+	boot_time.decision_us = boot_timer_lap(SystemCoreClock);
+	if (!pressed && valid) {
+		__HAL_RCC_GPIOA_CLK_DISABLE(); // Leave the port as the reset left it
 		jump_to_user_app();
 	}
+	boot_time.handoff_us = *warm_boot_register(WARM_BOOT_BKP_HANDOFF); // Of the handoff before this reset
+}
+
+/**
+ * @fn uint8_t app_image_valid(void)
+ * @brief Checks that an application is present: its initial stack pointer lies in SRAM or
+ * 		  CCM RAM and its reset handler is a Thumb address inside the application area.
+ * 		  An erased application area (0xFFFFFFFF) fails both checks.
+ *
+ * @return 1 if the application can be started, 0 otherwise.
+ */
+uint8_t app_image_valid(void) {
+	uint32_t msp_value = *(volatile uint32_t*) APP_START_BASE_ADDRESS;
+	uint32_t reset_handler = *(volatile uint32_t*) (APP_START_BASE_ADDRESS + 4);
+	uint8_t msp_valid = ((msp_value > SRAM1_BASE) && (msp_value <= SRAM1_BASE + APP_SRAM_SIZE))
+			|| ((msp_value > CCMDATARAM_BASE) && (msp_value <= CCMDATARAM_BASE + APP_CCMRAM_SIZE));
+	uint8_t reset_valid = ((reset_handler & 1U) != 0) && (reset_handler > APP_START_BASE_ADDRESS)
+			&& (reset_handler - APP_START_BASE_ADDRESS < APP_AREA_SIZE);
+
+	return msp_valid && reset_valid;
+}
+
+/**
+ * @fn BL_App_Check_e app_image_check(void)
+ * @brief Full application check: the vector table (app_image_valid()), then the manifest,
+ * 		  then the CRC of the image_length bytes it declares. Only the real image is
+ * 		  checksummed, not the whole application area. The words are fed to the CRC
+ * 		  unit by DMA in two runs, around the image_crc word.
+ *
+ * @pre crc32_init() was called.
+ * @return BL_App_Check_e
+ */
+BL_App_Check_e app_image_check(void) {
+	if (!app_image_valid()) {
+		return APP_CHECK_BAD_VECTORS;
+	}
+
+	const BL_App_Manifest_t *manifest = app_manifest();
+	if (manifest == NULL) {
+		return APP_CHECK_NO_MANIFEST;
+	}
+
+	const uint32_t *image = (const uint32_t*) APP_START_BASE_ADDRESS;
+	uint32_t crc_word = ((uint32_t) &manifest->image_crc - APP_START_BASE_ADDRESS) / 4;
+	uint32_t crc = crc32_update_words(CRC32_INIT, image, crc_word); // DMA fed, see crc32_update_words()
+	crc = crc32_update_words(crc, &image[crc_word + 1], manifest->image_length / 4 - crc_word - 1);
+	app_image_crc = crc;
+
+	return (crc == manifest->image_crc) ? APP_CHECK_OK : APP_CHECK_BAD_CRC;
+}
+
+/**
+ * @fn const BL_App_Manifest_t* app_manifest(void)
+ * @brief Returns the manifest of the application if it has one: the magic matches and
+ * 		  the length is a multiple of 4, covers the manifest and fits the application area.
+ * 		  Its CRC is not checked.
+ *
+ * @return manifest in flash, NULL if there is none.
+ */
+const BL_App_Manifest_t* app_manifest(void) {
+	const BL_App_Manifest_t *manifest = (const BL_App_Manifest_t*) APP_MANIFEST_ADDRESS;
+	uint32_t min_length = APP_MANIFEST_ADDRESS + sizeof(BL_App_Manifest_t) - APP_START_BASE_ADDRESS;
+
+	if ((manifest->magic != APP_MANIFEST_MAGIC) || (manifest->image_length < min_length)
+			|| (manifest->image_length > APP_AREA_SIZE) || ((manifest->image_length & 3U) != 0)) {
+		return NULL;
+	}
+
+	return manifest;
+}
+
+/**
+ * @fn uint8_t warm_boot_match(void)
+ * @brief Checks the warm-boot record against the current flash generation and manifest.
+ *
+ * @return 1 if the application was validated and the flash has not been written since, 0 otherwise.
+ */
+static uint8_t warm_boot_match(void) {
+#ifdef WARM_BOOT_RECORD
+	const BL_App_Manifest_t *manifest = app_manifest();
+
+	__HAL_RCC_PWR_CLK_ENABLE(); // RTC register access; reset by boot_handoff()
+	return (manifest != NULL)
+			&& (*warm_boot_register(WARM_BOOT_BKP_MAGIC) == WARM_BOOT_MAGIC)
+			&& (*warm_boot_register(WARM_BOOT_BKP_GENERATION) == *warm_boot_register(WARM_BOOT_BKP_FLASH_GEN))
+			&& (*warm_boot_register(WARM_BOOT_BKP_DIGEST) == manifest->image_crc)
+			&& (*warm_boot_register(WARM_BOOT_BKP_LENGTH) == manifest->image_length);
+#else
+	return 0;
+#endif
+}
+
+/**
+ * @fn void warm_boot_store(void)
+ * @brief Records the manifest of the application that just passed app_image_check().
+ *
+ * @pre app_image_check() returned APP_CHECK_OK.
+ */
+static void warm_boot_store(void) {
+#ifdef WARM_BOOT_RECORD
+	const BL_App_Manifest_t *manifest = app_manifest();
+
+	__HAL_RCC_PWR_CLK_ENABLE();
+	PWR->CR |= PWR_CR_DBP; // Backup domain write access
+	*warm_boot_register(WARM_BOOT_BKP_DIGEST) = manifest->image_crc;
+	*warm_boot_register(WARM_BOOT_BKP_LENGTH) = manifest->image_length;
+	*warm_boot_register(WARM_BOOT_BKP_GENERATION) = *warm_boot_register(WARM_BOOT_BKP_FLASH_GEN);
+	*warm_boot_register(WARM_BOOT_BKP_MAGIC) = WARM_BOOT_MAGIC; // Last, the record is complete
+	PWR->CR &= ~PWR_CR_DBP;
+#endif
+}
+
+/**
+ * @fn void warm_boot_invalidate(void)
+ * @brief Advances the flash write generation, so the warm-boot record no longer matches.
+ * 		  Called before every flash unlock; only the first call of a session writes.
+ *
+ * @post The next boot runs the full app_image_check().
+ */
+BOOT_RAM_FUNC void warm_boot_invalidate(void) {
+#ifdef WARM_BOOT_RECORD
+	if (warm_boot_invalidated) {
+		return;
+	}
+	__HAL_RCC_PWR_CLK_ENABLE();
+	PWR->CR |= PWR_CR_DBP;
+	*warm_boot_register(WARM_BOOT_BKP_FLASH_GEN) += 1;
+	PWR->CR &= ~PWR_CR_DBP;
+	warm_boot_invalidated = 1;
+#endif
+}
+
+/**
+ * @fn volatile uint32_t* warm_boot_register(uint32_t)
+ * @brief Returns an RTC backup register.
+ *
+ * @param index -> WARM_BOOT_BKP_x.
+ * @return RTC->BKPxR.
+ */
+BOOT_RAM_FUNC static volatile uint32_t* warm_boot_register(uint32_t index) {
+	return &RTC->BKP0R + index;
+}
+
+/**
+ * @fn void boot_timer_start(void)
+ * @brief Starts the DWT cycle counter used to measure the boot phases.
+ *
+ * @post DWT->CYCCNT counts core cycles from 0.
+ */
+void boot_timer_start(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	boot_timer_last = 0;
+}
+
+/**
+ * @fn uint32_t boot_timer_lap(uint32_t)
+ * @brief Returns the time since boot_timer_start() or the previous lap.
+ *
+ * @param core_hz -> core clock during the lap (the reset clock for laps that end with the PLL switch).
+ * @return elapsed time in microseconds.
+ */
+uint32_t boot_timer_lap(uint32_t core_hz) {
+	uint32_t now = DWT->CYCCNT;
+	uint32_t elapsed = now - boot_timer_last;
+
+	boot_timer_last = now;
+
+	return elapsed / (core_hz / 1000000U);
+}
+
+/**
+ * @fn void vector_table_relocate(void)
+ * @brief Copies the vector table to SRAM and points VTOR at the copy, so that
+ * 		  exception entry does not read flash while it is being programmed or erased.
+ *
+ * @pre Called once the bootloader decided to stay in bootloader mode.
+ * @post Interrupts are vectored from ram_vector_table. Does nothing without BOOT_RAM_HOTPATH.
+ */
+void vector_table_relocate(void) {
+#ifdef BOOT_RAM_HOTPATH
+	extern uint32_t g_pfnVectors[]; // Defined in startup_stm32f407vgtx.s
+
+	for (uint32_t i = 0; i < VECTOR_TABLE_WORDS; i++) {
+		ram_vector_table[i] = g_pfnVectors[i];
+	}
+	__disable_irq();
+	SCB->VTOR = (uint32_t) ram_vector_table;
+	__DSB();
+	__enable_irq();
+#endif
+}
+
+/**
+ * @fn void boot_handoff(void)
+ * @brief Returns the MCU to its reset state before the application starts, so that it
+ * 		  does not inherit a running SysTick, a pending USB interrupt or a PLL clock it
+ * 		  does not expect. Every step is bounded: the background erase and the image CRC
+ * 		  are stopped first, the USB and the clock tree are torn down by the HAL within
+ * 		  its timeouts, the rest is register writes.
+ *
+ * @pre Called with interrupts enabled; works both before HAL_Init() and in bootloader mode.
+ * @post SysTick stopped, USB disconnected, core on HSI, all AHB/APB peripherals reset and
+ * 		 unclocked, all NVIC lines disabled and cleared, interrupts masked (PRIMASK = 1).
+ * 		 boot_time.handoff_us is set and kept in RTC->BKP5R; DWT->CYCCNT keeps counting
+ * 		 for the application.
+ */
+static void boot_handoff(void) {
+	uint32_t core_hz = SystemCoreClock;
+
+	boot_timer_lap(core_hz); // Handoff starts here
+	flash_erase_wait(); // Never leave the bootloader with an erase in progress
+
+	// Needs the interrupts and the tick: soft disconnect, so the host sees the device leave
+	if (hUsbDeviceFS.pData != NULL) {
+		USBD_DeInit(&hUsbDeviceFS);
+	}
+	uint32_t elapsed_us = boot_timer_lap(core_hz);
+
+	// Back to HSI, HSE and PLL off; skipped when the clock tree is still as the reset left it
+	if ((RCC->CFGR != 0) || ((RCC->CR & (RCC_CR_HSEON | RCC_CR_PLLON)) != 0)) {
+		// Core on HSI first, so that the rest of the handoff is counted at HSI_VALUE
+		uint32_t tickstart = HAL_GetTick();
+		__HAL_RCC_HSI_ENABLE();
+		while ((__HAL_RCC_GET_FLAG(RCC_FLAG_HSIRDY) == RESET) && (HAL_GetTick() - tickstart < HSI_TIMEOUT_VALUE)) {
+		}
+		__HAL_RCC_SYSCLK_CONFIG(RCC_SYSCLKSOURCE_HSI);
+		while ((__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_HSI)
+				&& (HAL_GetTick() - tickstart < CLOCKSWITCH_TIMEOUT_VALUE)) {
+		}
+		elapsed_us += boot_timer_lap(core_hz);
+		HAL_RCC_DeInit();
+	}
+
+	__disable_irq();
+	SysTick->CTRL = 0;
+	SysTick->LOAD = 0;
+	SysTick->VAL = 0;
+	SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk | SCB_ICSR_PENDSVCLR_Msk;
+
+	// Reset of all peripherals, then their clocks back to the reset values
+	__HAL_RCC_AHB1_FORCE_RESET();
+	__HAL_RCC_AHB1_RELEASE_RESET();
+	__HAL_RCC_AHB2_FORCE_RESET();
+	__HAL_RCC_AHB2_RELEASE_RESET();
+	__HAL_RCC_AHB3_FORCE_RESET();
+	__HAL_RCC_AHB3_RELEASE_RESET();
+	__HAL_RCC_APB1_FORCE_RESET();
+	__HAL_RCC_APB1_RELEASE_RESET();
+	__HAL_RCC_APB2_FORCE_RESET();
+	__HAL_RCC_APB2_RELEASE_RESET();
+	RCC->AHB1ENR = AHB1ENR_RESET_VALUE;
+	RCC->AHB2ENR = 0;
+	RCC->AHB3ENR = 0;
+	RCC->APB1ENR = 0;
+	RCC->APB2ENR = 0;
+
+	for (uint32_t i = 0; i < sizeof(NVIC->ICER) / sizeof(NVIC->ICER[0]); i++) {
+		NVIC->ICER[i] = 0xFFFFFFFF;
+		NVIC->ICPR[i] = 0xFFFFFFFF;
+	}
+	__DSB();
+	__ISB();
+
+	SystemCoreClock = HSI_VALUE;
+	boot_time.handoff_us = elapsed_us + boot_timer_lap(HSI_VALUE);
+
+	// Kept for the application and the next boot; PWR back to its reset state afterwards
+	__HAL_RCC_PWR_CLK_ENABLE();
+	PWR->CR |= PWR_CR_DBP;
+	*warm_boot_register(WARM_BOOT_BKP_HANDOFF) = boot_time.handoff_us;
+	PWR->CR &= ~PWR_CR_DBP;
+	__HAL_RCC_PWR_CLK_DISABLE();
 }
 
 /**
@@ -49,56 +433,52 @@ void address_selection(void) {
  * @pre   User application must be correctly flashed starting at APP_START_BASE_ADDRESS.
  * The first word at APP_START_BASE_ADDRESS must be the initial Main Stack Pointer (MSP) value.
  * The second word must be the address of the application's Reset Handler.
- * @post  MCU execution context is transferred to the user application. This function does not return.
+ * @post  MCU execution context is transferred to the user application, with the MCU in its
+ * reset state (boot_handoff()). This function does not return.
  * @param None
  * @retval None
  */
 void jump_to_user_app(void) {
 	void (*app_reset_handler)(void);
 
-	uint32_t msp_value = *(volatile uint32_t*) APP_START_BASE_ADDRESS;
-	__set_MSP(msp_value);
-	SCB->VTOR = APP_START_BASE_ADDRESS;
+	boot_handoff();
 
+	uint32_t msp_value = *(volatile uint32_t*) APP_START_BASE_ADDRESS;
 	uint32_t resethandler_address =
 			*(volatile uint32_t*) (APP_START_BASE_ADDRESS + 4);
 	app_reset_handler = (void*) resethandler_address;
+
+	SCB->VTOR = APP_START_BASE_ADDRESS;
+	__set_MSP(msp_value);
+	__DSB();
+	__ISB();
+	__enable_irq(); // Applications expect PRIMASK = 0 as after reset; every NVIC line is disabled
 	app_reset_handler();
 
     // Code should never reach here if the jump is successful.
 	while (1) {
-		HAL_GPIO_TogglePin(LED1_GPIO_Port, LED1_Pin);
-		HAL_GPIO_TogglePin(LED2_GPIO_Port, LED2_Pin);
-		HAL_GPIO_TogglePin(LED3_GPIO_Port, LED3_Pin);
-		HAL_GPIO_TogglePin(LED4_GPIO_Port, LED4_Pin);
-
-		HAL_Delay(100);
 	}
 }
 
 /**
  * @brief Writes data to Flash memory.
  * @pre   Target flash area must be erased before writing.
- * Flash memory must be unlocked.
  * @post  Data is written to the specified flash address. Flash memory is locked afterwards.
  * @param mem_value: Pointer to the data buffer to be written.
  * @param mem_address: Starting address in Flash memory to write to.
  * @param len: Number of bytes to write.
  * @retval HAL_OK (0) if successful, HAL_ERROR or other HAL status on failure.
  */
-uint8_t mem_write(uint8_t *mem_value, uint32_t mem_address, uint32_t len) {
+BOOT_RAM_FUNC uint8_t mem_write(uint8_t *mem_value, uint32_t mem_address, uint32_t len) {
+	flash_erase_wait(); // A background erase owns the flash interface until it completes
+
 	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_SET); // LED turns on before the write operation
 	uint8_t status = HAL_OK;
 
-	HAL_FLASH_Unlock(); // Unlock the Flash memory
+	flash_unlock(); // Unlock the Flash memory
 
-	for (uint32_t i = 0; i < len; i++) {
-		 // Note: Consider using larger program types (HalfWord, Word, DoubleWord)
-		 //       if possible and if data/address alignment allows, for faster writing.
-		 //       Requires checking FLASH_Program_Parallelism in datasheet.
-		 //       Current implementation uses FLASH_TYPEPROGRAM_BYTE for simplicity.
-		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, mem_address + i, mem_value[i]); // The program data sent is written byte by byte to the relevant address
-	}
+	flash_mark_written(mem_address, len);
+	status = flash_program(mem_value, mem_address, len);
 
 	HAL_FLASH_Lock(); // Lock the Flash memory regardless of write success/failure
 	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_RESET); // LED turns off after the write operation
@@ -106,53 +486,706 @@ uint8_t mem_write(uint8_t *mem_value, uint32_t mem_address, uint32_t len) {
 	return status;
 }
 
+/**
+ * @fn void flash_mark_erased(uint32_t, uint32_t)
+ * @brief Records sectors as erased in this session, so that erase-on-demand skips them.
+ *
+ * @param first_sector -> first erased sector.
+ * @param number_of_sector -> number of erased sectors.
+ */
+BOOT_RAM_FUNC static void flash_mark_erased(uint32_t first_sector, uint32_t number_of_sector) {
+	for (uint32_t i = first_sector; (i < first_sector + number_of_sector) && (i < TOTAL_SECTORS); i++) {
+		sector_erased_mask |= (uint16_t) (1U << i);
+		sector_written_mask &= (uint16_t) ~(1U << i);
+	}
+}
+
+/**
+ * @fn void flash_mark_written(uint32_t, uint32_t)
+ * @brief Records the sectors of [address, address + len) as programmed: they are no
+ * 		  longer blank, so erase-on-demand checks the target range of a later write
+ * 		  into them instead of skipping the erase (see flash_erase_on_demand()).
+ *
+ * @pre No flash operation is running (reads flash_sector_lookup).
+ * @param address -> first programmed byte.
+ * @param len -> number of programmed bytes.
+ */
+BOOT_RAM_FUNC static void flash_mark_written(uint32_t address, uint32_t len) {
+	if (len == 0) {
+		return;
+	}
+
+	uint8_t first_sector = flash_get_sector(address);
+	uint8_t last_sector = flash_get_sector(address + len - 1);
+	if ((first_sector == INVALID_SECTOR_NUMBER) || (last_sector == INVALID_SECTOR_NUMBER)) {
+		return; // HAL_FLASH_Program() rejects the address
+	}
+	for (uint32_t i = first_sector; i <= last_sector; i++) {
+		sector_erased_mask &= (uint16_t) ~(1U << i);
+		sector_written_mask |= (uint16_t) (1U << i);
+	}
+}
+
+/**
+ * @fn uint8_t flash_get_sector(uint32_t)
+ * @brief Returns the flash sector that contains the given address in O(1):
+ * 		  flash_sector_lookup is indexed by the 16 Kbytes granule of the address.
+ * 		  The offset inside the sector is address - flash_sectors[sector].address.
+ *
+ * @param address -> flash address.
+ * @return sector number, or INVALID_SECTOR_NUMBER if the address is outside the flash.
+ */
+BOOT_RAM_FUNC uint8_t flash_get_sector(uint32_t address) {
+	if ((address < F4_SECTOR_0) || (address - F4_SECTOR_0 >= FLASH_TOTAL_SIZE)) {
+		return INVALID_SECTOR_NUMBER;
+	}
+
+	return flash_sector_lookup[(address - F4_SECTOR_0) >> FLASH_LOOKUP_SHIFT];
+}
+
+/**
+ * @fn uint8_t flash_check_range(uint32_t, uint32_t)
+ * @brief Checks that [address, address + len) lies inside the application area
+ * 		  (from APP_START_BASE_ADDRESS to the end of the flash).
+ *
+ * @param address -> first byte of the range.
+ * @param len -> number of bytes.
+ * @return HAL_OK (0) if the range is valid, INVALID_SECTOR otherwise.
+ */
+BOOT_RAM_FUNC uint8_t flash_check_range(uint32_t address, uint32_t len) {
+	if ((address < APP_START_BASE_ADDRESS) || (len > F4_SECTOR_0 + FLASH_TOTAL_SIZE - address)) {
+		return INVALID_SECTOR;
+	}
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t flash_erase_on_demand(uint32_t, uint32_t)
+ * @brief Erases every sector touched by [address, address + len) that has not been
+ * 		  erased in this session yet. Lets the host write an image without explicit
+ * 		  TARGET_FLASH_ERASE frames; erase time then scales with the image size.
+ *
+ * 		  A sector programmed since its erase in this session is only erased again
+ * 		  when the target range is not blank (the host writes over its own data, e.g.
+ * 		  a second upload). Its earlier data is lost, so DIFF_RESEND_SECTOR is
+ * 		  returned and the host resends from the start of the sector.
+ *
+ * @pre None. Waits for a running background erase first.
+ * @post The range is blank in flash.
+ * @param address -> first byte that will be written.
+ * @param len -> number of bytes that will be written.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR if the range leaves the flash or
+ * 		   would erase a bootloader sector, DIFF_RESEND_SECTOR, otherwise the erase status.
+ */
+BOOT_RAM_FUNC uint8_t flash_erase_on_demand(uint32_t address, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	if (len == 0) {
+		return HAL_OK;
+	}
+	flash_erase_wait(); // Sectors of a running erase are marked when it completes
+
+	uint8_t first_sector = flash_get_sector(address);
+	uint8_t last_sector = flash_get_sector(address + len - 1);
+	if ((first_sector == INVALID_SECTOR_NUMBER) || (last_sector == INVALID_SECTOR_NUMBER)) {
+		return INVALID_SECTOR;
+	}
+
+	for (uint8_t sector = first_sector; (sector <= last_sector) && (status == HAL_OK); sector++) {
+		uint16_t bit = (uint16_t) (1U << sector);
+		if ((sector_erased_mask & bit) != 0) {
+			continue; // Still blank since its erase
+		}
+		if (sector < APP_START_SECTOR) {
+			return INVALID_SECTOR; // Never erase the bootloader on demand
+		}
+		uint8_t written = ((sector_written_mask & bit) != 0);
+		if (written) {
+			uint32_t sector_start = flash_sectors[sector].address;
+			uint32_t sector_end = sector_start + flash_sectors[sector].size;
+			uint32_t start = (address > sector_start) ? address : sector_start;
+			uint32_t end = (address + len < sector_end) ? address + len : sector_end;
+			if (flash_range_is_blank(start, end - start)) {
+				continue; // Next part of the data written since the erase
+			}
+		}
+		response_cache_reset();
+		status = flash_erase(sector, 1);
+		if ((status == HAL_OK) && written) {
+			diff_stats.resend_sector = sector; // Data written before into this sector is lost
+			return DIFF_RESEND_SECTOR;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t mem_write_diff(const uint8_t*, uint32_t, uint32_t)
+ * @brief Differential write: compares the data with the current flash content and
+ * 		  only programs what changed. Identical words are skipped, words that only
+ * 		  need 1->0 bit transitions are programmed over the old content, and a sector
+ * 		  is erased only when a 0->1 transition forces it.
+ *
+ * 		  If a sector must be erased after earlier data of this session was kept in it
+ * 		  without an erase, that data is lost by the erase. The sector is then erased
+ * 		  and DIFF_RESEND_SECTOR is returned; the host must resend the image from the
+ * 		  start of that sector (diff_stats.resend_sector).
+ *
+ * @pre None. Waits for a running background erase first.
+ * @post Flash holds the data. diff_stats is updated.
+ * @param data -> pointer to the data to be written.
+ * @param address -> flash address of the first byte.
+ * @param len -> number of bytes to write.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR if the range leaves the flash or
+ * 		   touches the bootloader, DIFF_RESEND_SECTOR, or the failing HAL status.
+ */
+BOOT_RAM_FUNC uint8_t mem_write_diff(const uint8_t *data, uint32_t address, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	flash_erase_wait();
+	flash_data_cache_reset();
+
+	while ((len > 0) && (status == HAL_OK)) {
+		uint8_t sector = flash_get_sector(address);
+		if ((sector == INVALID_SECTOR_NUMBER) || (sector < APP_START_SECTOR)) {
+			return INVALID_SECTOR;
+		}
+		uint32_t sector_end = flash_sectors[sector].address + flash_sectors[sector].size;
+		uint32_t chunk = ((sector_end - address) < len) ? (sector_end - address) : len;
+		const uint8_t *old = (const uint8_t*) address;
+		uint16_t bit = (uint16_t) (1U << sector);
+
+		if ((sector_erased_mask & bit) == 0) {
+			uint8_t needs_erase = 0;
+			for (uint32_t i = 0; i < chunk; i++) {
+				if ((old[i] & data[i]) != data[i]) { // A 0->1 transition needs an erase
+					needs_erase = 1;
+					break;
+				}
+			}
+			if (needs_erase) {
+				uint8_t kept = ((diff_kept_mask & bit) != 0);
+				uint8_t written = ((sector_written_mask & bit) != 0); // Data of this session is in the sector
+				status = flash_erase(sector, 1);
+				if (status != HAL_OK) {
+					break;
+				}
+				diff_stats.erases_done++;
+				if (kept) {
+					diff_kept_mask &= (uint16_t) ~bit;
+					diff_stats.erases_avoided--;
+				}
+				if (kept || written) {
+					diff_stats.resend_sector = sector;
+					return DIFF_RESEND_SECTOR;
+				}
+			} else if (((diff_kept_mask | sector_written_mask) & bit) == 0) {
+				diff_kept_mask |= bit; // Sector keeps its old content, no erase needed so far
+				diff_stats.erases_avoided++;
+			}
+		}
+
+		// Program only the 4-byte groups that differ from the flash content
+		uint32_t offset = 0;
+		HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_SET); // LED turns on before the write operation
+		flash_unlock();
+		while ((offset < chunk) && (status == HAL_OK)) {
+			uint32_t group = 4 - ((address + offset) & 0x3);
+			if (group > chunk - offset) {
+				group = chunk - offset;
+			}
+			uint8_t identical = 1;
+			for (uint32_t i = offset; i < offset + group; i++) {
+				if (old[i] != data[i]) {
+					identical = 0;
+					break;
+				}
+			}
+			if (identical) {
+				diff_stats.words_skipped++;
+			} else {
+				flash_mark_written(address + offset, group);
+				status = flash_program(&data[offset], address + offset, group);
+				diff_stats.words_programmed++;
+			}
+			offset += group;
+		}
+		HAL_FLASH_Lock();
+		HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_RESET); // LED turns off after the write operation
+
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t flash_region_crc(uint32_t, uint32_t, uint32_t*)
+ * @brief Computes the CRC-32 (see crc32.h) of a flash region with the CRC unit.
+ *
+ * @pre None. Waits for a running background erase first.
+ * @param address -> first byte of the region.
+ * @param len -> number of bytes.
+ * @param crc -> receives the CRC-32 of the region.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR if the region leaves the flash.
+ */
+BOOT_RAM_FUNC uint8_t flash_region_crc(uint32_t address, uint32_t len, uint32_t *crc) {
+	if ((flash_get_sector(address) == INVALID_SECTOR_NUMBER)
+			|| (len > F4_SECTOR_0 + FLASH_TOTAL_SIZE - address)) {
+		return INVALID_SECTOR;
+	}
+
+	flash_erase_wait();
+	flash_data_cache_reset(); // The region may have been programmed since it was last read
+	*crc = crc32_compute((const uint8_t*) address, len);
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t flash_sector_backup(uint8_t, uint8_t, uint32_t)
+ * @brief Copies the first len bytes of a sector into a scratch sector, so the old
+ * 		  content stays readable after the sector is erased and rewritten.
+ *
+ * @pre None. Waits for a running background erase first.
+ * @post The scratch sector holds the copy and is no longer counted as erased in this
+ * 		 session, so a later write into it erases it again.
+ * @param sector -> sector to copy.
+ * @param scratch_sector -> sector that receives the copy (erased first).
+ * @param len -> number of bytes from the start of the sector, at most the size of both sectors.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR for invalid parameters, otherwise the HAL status.
+ */
+BOOT_RAM_FUNC uint8_t flash_sector_backup(uint8_t sector, uint8_t scratch_sector, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	if ((sector >= TOTAL_SECTORS) || (scratch_sector >= TOTAL_SECTORS) || (scratch_sector < APP_START_SECTOR)
+			|| (scratch_sector == sector) || (len > flash_sectors[sector].size)
+			|| (len > flash_sectors[scratch_sector].size)) {
+		return INVALID_SECTOR;
+	}
+
+	status = flash_erase(scratch_sector, 1); // Skipped if already blank
+	if ((status == HAL_OK) && (len != 0)) {
+		status = mem_write((uint8_t*) flash_sectors[sector].address, flash_sectors[scratch_sector].address, len);
+	}
+	sector_erased_mask &= (uint16_t) ~(1U << scratch_sector);
+	sector_written_mask &= (uint16_t) ~(1U << scratch_sector); // Not image data: a later write erases it without a resend
+	flash_data_cache_reset(); // The scratch sector is read right after programming
+
+	return status;
+}
+
+/**
+ * @fn uint8_t flash_sector_rewrite(uint8_t, const uint8_t*, uint32_t)
+ * @brief Gives the start of a sector new content with mem_write_diff(): identical
+ * 		  content is left untouched and the sector is only erased for a 0->1 transition.
+ * 		  The whole new content is at hand, so an erase never needs a resend.
+ *
+ * @pre None. Waits for a running background erase first.
+ * @post The first len bytes of the sector hold data. diff_stats is updated.
+ * @param sector -> application sector.
+ * @param data -> new content (RAM).
+ * @param len -> number of bytes from the start of the sector, at most its size.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR for invalid parameters, otherwise the HAL status.
+ */
+BOOT_RAM_FUNC uint8_t flash_sector_rewrite(uint8_t sector, const uint8_t *data, uint32_t len) {
+	uint16_t bit = (uint16_t) (1U << sector);
+
+	if ((sector >= TOTAL_SECTORS) || (sector < APP_START_SECTOR) || (len > flash_sectors[sector].size)) {
+		return INVALID_SECTOR;
+	}
+	if (len == 0) {
+		return HAL_OK;
+	}
+
+	flash_erase_wait();
+	sector_erased_mask &= (uint16_t) ~bit; // Compare with the flash content, not with an erased sector
+	sector_written_mask &= (uint16_t) ~bit; // The whole new content is given, nothing to resend
+	diff_kept_mask &= (uint16_t) ~bit;
+
+	return mem_write_diff(data, flash_sectors[sector].address, len);
+}
+
+/**
+ * @fn void flash_unlock(void)
+ * @brief Unlocks the flash for a program or erase operation. Every flash change goes
+ * 		  through here, so the warm-boot record is invalidated first.
+ */
+BOOT_RAM_FUNC static void flash_unlock(void) {
+	warm_boot_invalidate();
+	HAL_FLASH_Unlock();
+}
+
+/**
+ * @fn void flash_data_cache_reset(void)
+ * @brief Resets the ART data cache, which may still hold lines read before the
+ * 		  last program operation, so that following reads see the real flash content.
+ */
+BOOT_RAM_FUNC static void flash_data_cache_reset(void) {
+	__HAL_FLASH_DATA_CACHE_DISABLE();
+	__HAL_FLASH_DATA_CACHE_RESET();
+	__HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+/**
+ * @fn uint8_t flash_is_blank(uint32_t, uint32_t)
+ * @brief Checks whether a flash area is fully erased (all 0xFF).
+ * 		  Eight words are loaded per iteration so the compiler can use LDM bursts,
+ * 		  and the check exits at the first block that holds programmed data.
+ *
+ * @param address -> start address, 32-byte aligned.
+ * @param size -> size of the area in bytes, multiple of 32.
+ * @return 1 if the area is blank, 0 otherwise.
+ */
+BOOT_RAM_FUNC static uint8_t flash_is_blank(uint32_t address, uint32_t size) {
+	const uint32_t *word = (const uint32_t*) address;
+	const uint32_t *end = (const uint32_t*) (address + size);
+
+	flash_data_cache_reset();
+
+	while (word < end) {
+		if ((word[0] & word[1] & word[2] & word[3] & word[4] & word[5] & word[6] & word[7]) != 0xFFFFFFFFU) {
+			return 0;
+		}
+		word += 8;
+	}
+
+	return 1;
+}
+
+/**
+ * @fn uint8_t flash_range_is_blank(uint32_t, uint32_t)
+ * @brief Checks that every byte of [address, address + len) is 0xFF, without
+ * 		  alignment requirements.
+ *
+ * @return 1 if the range is blank, 0 otherwise.
+ */
+BOOT_RAM_FUNC static uint8_t flash_range_is_blank(uint32_t address, uint32_t len) {
+	const uint8_t *byte = (const uint8_t*) address;
+
+	flash_data_cache_reset();
+
+	for (uint32_t i = 0; i < len; i++) {
+		if (byte[i] != 0xFFU) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @fn uint8_t flash_erase_prepare(uint8_t, uint8_t, BL_Erase_Progress_t*, uint16_t*)
+ * @brief Validates the erase parameters and fills the progress of a new erase.
+ * 		  Sectors that are already blank are skipped (recorded in skipped_mask),
+ * 		  the others are queued in the pending mask.
+ *
+ * @param sector_number -> starting sector number, or 0xFF for a mass erase.
+ * @param number_of_sector -> number of sectors to erase (clamped to the last sector).
+ * @param progress -> receives the progress of the erase, state excepted.
+ * @param pending -> receives the sectors to erase (bit n -> sector n).
+ * @return HAL_OK (0) if the parameters are valid, INVALID_SECTOR otherwise.
+ */
+BOOT_RAM_FUNC static uint8_t flash_erase_prepare(uint8_t sector_number, uint8_t number_of_sector, BL_Erase_Progress_t *progress,
+		uint16_t *pending) {
+    // Validate sector number and count
+	if (number_of_sector > TOTAL_SECTORS )
+        return INVALID_SECTOR; // Invalid parameters
+
+	if ((sector_number != 0xff) && (sector_number >= TOTAL_SECTORS)) {
+		return INVALID_SECTOR; // Invalid parameters
+	}
+
+	progress->mass_erase = (sector_number == (uint8_t) 0xff);
+	progress->erased_sectors = 0;
+	progress->failed_sector = INVALID_SECTOR_NUMBER;
+	progress->skipped_mask = 0;
+	*pending = 0;
+
+	if (progress->mass_erase) {
+		progress->first_sector = 0;
+		progress->total_sectors = TOTAL_SECTORS;
+		return HAL_OK;
+	}
+
+	uint8_t remaining_sector = TOTAL_SECTORS - sector_number;
+	if (number_of_sector > remaining_sector) {
+		number_of_sector = remaining_sector;
+	}
+	progress->first_sector = sector_number;
+	progress->total_sectors = number_of_sector;
+
+	for (uint8_t sector = sector_number; sector < sector_number + number_of_sector; sector++) {
+		if (flash_is_blank(flash_sectors[sector].address, flash_sectors[sector].size)) {
+			progress->skipped_mask |= (uint16_t) (1U << sector); // Already blank, no erase needed
+			progress->erased_sectors++;
+			flash_mark_erased(sector, 1);
+		} else {
+			*pending |= (uint16_t) (1U << sector);
+		}
+	}
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t flash_next_pending_sector(uint16_t)
+ * @brief Returns the lowest sector queued in a pending mask.
+ *
+ * @pre pending is not zero.
+ */
+BOOT_RAM_FUNC static uint8_t flash_next_pending_sector(uint16_t pending) {
+	uint8_t sector = 0;
+
+	while ((pending & (1U << sector)) == 0) {
+		sector++;
+	}
+
+	return sector;
+}
+
+/**
+ * @fn void flash_erase_finish(BL_Erase_State_e)
+ * @brief Ends the current erase: locks the flash, turns LED2 off and publishes the final state.
+ *
+ * @param state -> ERASE_DONE or ERASE_ERROR.
+ */
+BOOT_RAM_FUNC static void flash_erase_finish(BL_Erase_State_e state) {
+	erase_pending_mask = 0;
+	erase_running_sector = INVALID_SECTOR_NUMBER;
+	HAL_FLASH_Lock();
+	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_RESET); // LED turns off after the erase operation
+	erase_progress.state = state;
+}
+
 /**
  * @brief Erases a specified number of flash sectors starting from a given sector number.
- * @pre   Flash memory should be unlocked before calling this function.
- * Interrupts might need to be disabled during critical flash operations.
+ * 		  Sectors that are already blank are not erased again.
+ * 		  Used internally (erase on demand, differential write, patch); erase_progress
+ * 		  keeps describing the last background erase, which a host may be polling.
+ * @pre   Interrupts might need to be disabled during critical flash operations.
  * @post  Specified flash sectors are erased. Flash memory is locked afterwards.
  * @param sector_number: The starting sector number to erase (0 to TOTAL_SECTORS - 1).
  * @param number_of_sector: The total number of sectors to erase.
  * @retval HAL_OK (0) if successful, HAL_ERROR or HAL_BUSY/HAL_TIMEOUT otherwise.
  * Returns INVALID_SECTOR (defined in boot.h) if sector parameters are invalid.
  */
-uint8_t flash_erase(uint8_t sector_number, uint8_t number_of_sector) {
-	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_SET); // LED turns on before the erase operation
+BOOT_RAM_FUNC uint8_t flash_erase(uint8_t sector_number, uint8_t number_of_sector) {
     FLASH_EraseInitTypeDef EraseInitStruct; // Structure for erase configuration
+    BL_Erase_Progress_t progress;           // Progress of this erase, separate from the background one
+    uint16_t pending = 0;                   // Sectors still to erase
     uint32_t sectorError = 0;               // Variable to store potential error during erase
-    HAL_StatusTypeDef status = HAL_OK;      // Variable to store HAL function return status
+    uint8_t status = HAL_OK;                // Variable to store HAL function return status
 
-    // Validate sector number and count
-	if (number_of_sector > TOTAL_SECTORS )
-        return INVALID_SECTOR; // Invalid parameters
+	flash_erase_wait(); // A background erase owns the flash interface until it completes
 
-	if ((sector_number == 0xff) || (sector_number < 8)) {
-		if (sector_number == (uint8_t) 0xff) {
-			EraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
-		} else {
-			uint8_t remaining_sector = 8 - sector_number;
-			if (number_of_sector > remaining_sector) {
-				number_of_sector = remaining_sector;
-			}
+	if (flash_erase_prepare(sector_number, number_of_sector, &progress, &pending) != HAL_OK) {
+		return INVALID_SECTOR; // Invalid parameters
+	}
+
+	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_SET); // LED turns on before the erase operation
+	flash_unlock(); // Unlock the Flash memory for erase/write operations
+	EraseInitStruct.Banks = FLASH_BANK_1;
+	EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3; // Voltage range for STM32F407 (2.7V to 3.6V)
+
+	// Note: HAL_FLASHEx_Erase blocks until the operation is complete.
+	if (progress.mass_erase) {
+		EraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
+		status = (uint8_t) HAL_FLASHEx_Erase(&EraseInitStruct, &sectorError);
+		if (status == HAL_OK) {
+			flash_mark_erased(0, TOTAL_SECTORS);
+		}
+	} else {
+		while ((pending != 0) && (status == HAL_OK)) {
+			uint8_t sector = flash_next_pending_sector(pending);
 		    EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS; // Erase type is sectors
-		    EraseInitStruct.Sector        = sector_number;         // Starting sector number
-		    EraseInitStruct.NbSectors     = number_of_sector;      // Number of sectors to erase
+		    EraseInitStruct.Sector        = sector;                  // Sector number
+		    EraseInitStruct.NbSectors     = 1;                       // Number of sectors to erase
+			status = (uint8_t) HAL_FLASHEx_Erase(&EraseInitStruct, &sectorError);
+			if (status == HAL_OK) {
+				flash_mark_erased(sector, 1);
+				pending &= (uint16_t) ~(1U << sector);
+			}
 		}
-		EraseInitStruct.Banks = FLASH_BANK_1;
+	}
 
-		HAL_FLASH_Unlock(); // Unlock the Flash memory for erase/write operations
-	    EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3; // Voltage range for STM32F407 (2.7V to 3.6V)
-		// Perform the erase operation
-		// Note: HAL_FLASHEx_Erase blocks until the operation is complete.
-		status = (uint8_t) HAL_FLASHEx_Erase(&EraseInitStruct, &sectorError);
-		HAL_FLASH_Lock(); // Lock the Flash memory
+	HAL_FLASH_Lock();
+	HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_RESET); // LED turns off after the erase operation
 
-		HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_RESET); // LED turns off after the erase operation
+	return status;
+}
+
+/**
+ * @fn uint8_t flash_erase_async(uint8_t, uint8_t)
+ * @brief Accepts a background erase driven by the FLASH EOP/ERR interrupt.
+ * 		  Blank sectors are skipped (see erase_progress.skipped_mask), the others are
+ * 		  erased one at a time by flash_erase_process(). Returns without starting
+ * 		  the flash: the first erase starts once the host has taken the response
+ * 		  accepting it (at most ERASE_START_HOLD_MS later), since a running erase
+ * 		  stalls every fetch from flash. Progress is tracked in erase_progress.
+ *
+ * @pre No other background erase is running.
+ * @post Erase is accepted, LED2 stays on and the flash stays unlocked until it completes.
+ * @param sector_number -> starting sector number, or 0xFF for a mass erase.
+ * @param number_of_sector -> number of sectors to erase.
+ * @return HAL_OK (0) if the erase was accepted, HAL_BUSY if an erase is already
+ * 		   running, INVALID_SECTOR if the parameters are invalid.
+ */
+BOOT_RAM_FUNC uint8_t flash_erase_async(uint8_t sector_number, uint8_t number_of_sector) {
+    BL_Erase_Progress_t progress;
+    uint16_t pending = 0;
+
+	if (erase_progress.state == ERASE_BUSY) {
+		return HAL_BUSY;
+	}
+	if (flash_erase_prepare(sector_number, number_of_sector, &progress, &pending) != HAL_OK) {
+		return INVALID_SECTOR;
+	}
+	progress.state = (progress.mass_erase || (pending != 0)) ? ERASE_BUSY : ERASE_DONE; // DONE: every sector was blank
+	erase_pending_mask = pending;
+	erase_start_held = 1;
+	erase_accept_tick = HAL_GetTick();
+	erase_progress = progress;
+	if (progress.state == ERASE_BUSY) {
+		HAL_GPIO_WritePin(LED2_GPIO_Port, LED2_Pin, GPIO_PIN_SET); // LED stays on while the erase runs
+	}
+
+	return HAL_OK;
+}
 
-		return status;
+/**
+ * @fn uint8_t flash_erase_range(uint32_t, uint32_t)
+ * @brief Erases the smallest set of sectors that covers [address, address + len).
+ * 		  The covered sectors are contiguous, so they are started as a single
+ * 		  background erase request (see flash_erase_async()).
+ *
+ * @pre No other background erase is running.
+ * @post Erase of the covering sectors is running or done.
+ * @param address -> first byte to be erased.
+ * @param len -> number of bytes to be erased.
+ * @return HAL_OK (0) if the erase was accepted, HAL_BUSY if an erase is already
+ * 		   running, INVALID_SECTOR if the range is empty, leaves the flash or
+ * 		   touches a bootloader sector.
+ */
+BOOT_RAM_FUNC uint8_t flash_erase_range(uint32_t address, uint32_t len) {
+	if (len == 0) {
+		return INVALID_SECTOR;
+	}
+
+	uint8_t first_sector = flash_get_sector(address);
+	uint8_t last_sector = flash_get_sector(address + len - 1);
+	if ((first_sector == INVALID_SECTOR_NUMBER) || (last_sector == INVALID_SECTOR_NUMBER)
+			|| (address + len - 1 < address)) {
+		return INVALID_SECTOR;
+	}
+	if (first_sector < APP_START_SECTOR) {
+		return INVALID_SECTOR; // Never erase the bootloader
+	}
+
+	return flash_erase_async(first_sector, (uint8_t) (last_sector - first_sector + 1));
+}
+
+/**
+ * @fn void flash_erase_process(void)
+ * @brief Starts the next queued sector (or the mass erase) of the background erase
+ * 		  when the previous one has completed. Called from the main loop. The first
+ * 		  start is held until the TX ring is empty, so the response accepting the
+ * 		  erase is on its way before the flash stalls fetches (the whole main loop
+ * 		  without BOOT_RAM_HOTPATH).
+ *
+ * @pre None. Does nothing if no background erase is waiting for its next sector.
+ * @post The next pending sector erase is running.
+ */
+BOOT_RAM_FUNC void flash_erase_process(void) {
+    FLASH_EraseInitTypeDef EraseInitStruct;
+
+	if ((erase_progress.state != ERASE_BUSY) || (erase_running_sector != INVALID_SECTOR_NUMBER)
+			|| (!erase_progress.mass_erase && (erase_pending_mask == 0))) {
+		return;
+	}
+	if (erase_start_held && !CDC_TxIdle_FS() && (HAL_GetTick() - erase_accept_tick < ERASE_START_HOLD_MS)) {
+		return; // The accepted response is still queued
+	}
+	erase_start_held = 0;
+
+	EraseInitStruct.Banks = FLASH_BANK_1;
+	EraseInitStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+	if (erase_progress.mass_erase) {
+		erase_running_sector = 0; // Runs until the EOP interrupt of the mass erase
+		EraseInitStruct.TypeErase = FLASH_TYPEERASE_MASSERASE;
+	} else {
+		erase_running_sector = flash_next_pending_sector(erase_pending_mask);
+		EraseInitStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+		EraseInitStruct.Sector = erase_running_sector;
+		EraseInitStruct.NbSectors = 1;
+	}
+
+	flash_unlock(); // Locked again by flash_erase_finish()
+	if (HAL_FLASHEx_Erase_IT(&EraseInitStruct) != HAL_OK) {
+		if (!erase_progress.mass_erase) {
+			erase_progress.failed_sector = erase_running_sector;
+		}
+		flash_erase_finish(ERASE_ERROR);
+	}
+}
+
+/**
+ * @fn void flash_erase_wait(void)
+ * @brief Blocks until a running background erase has finished. A held erase is
+ * 		  started at once.
+ */
+BOOT_RAM_FUNC void flash_erase_wait(void) {
+	erase_start_held = 0; // The flash is needed now
+	while (erase_progress.state == ERASE_BUSY) {
+		flash_erase_process();
+	}
+}
+
+/**
+ * @fn void HAL_FLASH_EndOfOperationCallback(uint32_t)
+ * @brief FLASH EOP interrupt callback. Marks the sector started by flash_erase_process()
+ * 		  as erased and finishes the background erase when no sector is left.
+ *
+ * @param ReturnValue -> 0xFFFFFFFF at the end of a sector erase,
+ * 		  or the bank number at the end of a mass erase.
+ */
+BOOT_RAM_FUNC void HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue) {
+	if (erase_progress.state != ERASE_BUSY) {
+		return;
+	}
+
+	if (erase_progress.mass_erase) {
+		flash_mark_erased(0, TOTAL_SECTORS);
+		erase_progress.erased_sectors = erase_progress.total_sectors;
+		flash_erase_finish(ERASE_DONE);
+	} else if ((ReturnValue == 0xFFFFFFFFU) && (erase_running_sector != INVALID_SECTOR_NUMBER)) {
+		flash_mark_erased(erase_running_sector, 1);
+		erase_pending_mask &= (uint16_t) ~(1U << erase_running_sector);
+		erase_progress.erased_sectors++;
+		erase_running_sector = INVALID_SECTOR_NUMBER;
+		if (erase_pending_mask == 0) {
+			flash_erase_finish(ERASE_DONE);
+		}
+	}
+}
+
+/**
+ * @fn void HAL_FLASH_OperationErrorCallback(uint32_t)
+ * @brief FLASH ERR interrupt callback. Stops the background erase and records the faulty sector.
+ *
+ * @param ReturnValue -> faulty sector (or bank for a mass erase).
+ */
+BOOT_RAM_FUNC void HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue) {
+	if (erase_progress.state != ERASE_BUSY) {
+		return;
 	}
 
-    return INVALID_SECTOR; // Invalid parameters
+	erase_progress.failed_sector = (uint8_t) ReturnValue;
+	flash_erase_finish(ERASE_ERROR);
 }
 
 /************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,238 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : crc32.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : CRC-32 Service
+ * @description    : Byte-stream CRC-32/MPEG-2 used for link frames, flash
+ *                   region checksums and image validation. The STM32 CRC unit
+ *                   takes one 32-bit word per AHB write, so whole words are
+ *                   fed to CRC->DR (byte-swapped, the unit shifts the MSB
+ *                   first) and the remaining 1..3 bytes are finished in
+ *                   software from the unit's result. The HAL CRC driver is not
+ *                   part of this project, so the unit is used at register level.
+ *                   Without the unit (CRC not defined, e.g. host builds) the
+ *                   same value is computed in software.
+ *                   crc32_update_words() lets DMA2 Stream0 copy words to
+ *                   CRC->DR instead of the CPU. The unit has no DMA request,
+ *                   so the stream runs memory-to-memory with a fixed
+ *                   destination and is polled until it completes. DMA cannot
+ *                   byte-swap, so that CRC covers the words as stored (little
+ *                   endian), i.e. each 4-byte group in reverse order.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "main.h"
+#include "crc32.h"
+/* Prototypes ----------------------------------------------------------------*/
+void crc32_init(void);
+uint32_t crc32_compute(const uint8_t *data, uint32_t len);
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len);
+uint32_t crc32_update_sw(uint32_t crc, const uint8_t *data, uint32_t len);
+uint32_t crc32_update_words(uint32_t crc, const uint32_t *data, uint32_t words);
+static uint32_t crc32_preload_word(uint32_t crc);
+#ifdef CRC
+static uint8_t crc32_dma_feed(const uint32_t *data, uint32_t words);
+#endif
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn void crc32_init(void)
+ * @brief Enables the clocks of the CRC unit and of DMA2, which feeds it in crc32_update_words().
+ *
+ * @pre None.
+ * @post crc32_compute() and crc32_update_words() can use the CRC unit.
+ */
+void crc32_init(void) {
+#ifdef CRC
+	__HAL_RCC_CRC_CLK_ENABLE();
+	__HAL_RCC_DMA2_CLK_ENABLE();
+#endif
+}
+
+/**
+ * @fn uint32_t crc32_update_sw(uint32_t, const uint8_t*, uint32_t)
+ * @brief Continues a CRC-32/MPEG-2 computation in software, one bit at a time.
+ *
+ * @param crc -> CRC of the preceding bytes, or CRC32_INIT.
+ * @param data -> bytes to add.
+ * @param len -> number of bytes.
+ * @return CRC of the preceding bytes followed by data.
+ */
+uint32_t crc32_update_sw(uint32_t crc, const uint8_t *data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		crc ^= (uint32_t) data[i] << 24;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80000000UL) ? (crc << 1) ^ CRC32_POLYNOMIAL : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * @fn uint32_t crc32_compute(const uint8_t*, uint32_t)
+ * @brief Computes the CRC-32/MPEG-2 of a byte buffer (flash or RAM, any alignment).
+ *
+ * @pre crc32_init() was called. The CRC unit is not in use elsewhere (main loop only).
+ * @param data -> first byte.
+ * @param len -> number of bytes.
+ * @return CRC-32 of the buffer.
+ */
+uint32_t crc32_compute(const uint8_t *data, uint32_t len) {
+	return crc32_update(CRC32_INIT, data, len);
+}
+
+/**
+ * @fn uint32_t crc32_update(uint32_t, const uint8_t*, uint32_t)
+ * @brief Continues a CRC-32/MPEG-2 computation with the CRC unit, so that a CRC can be
+ * 		  computed over several pieces (e.g. an image with a field left out).
+ *
+ * @pre Same as crc32_compute().
+ * @param crc -> CRC of the preceding bytes, or CRC32_INIT.
+ * @param data -> bytes to add.
+ * @param len -> number of bytes.
+ * @return CRC of the preceding bytes followed by data.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t len) {
+#ifdef CRC
+	uint32_t words = len / 4;
+
+	CRC->CR = CRC_CR_RESET; // Data register back to 0xFFFFFFFF
+	if (crc != CRC32_INIT) {
+		CRC->DR = crc32_preload_word(crc); // The F4 unit has no initial value register
+	}
+	if (((uint32_t) data & 3U) == 0) {
+		const uint32_t *word = (const uint32_t*) data;
+		for (uint32_t i = 0; i < words; i++) {
+			CRC->DR = __REV(word[i]);
+		}
+	} else {
+		for (uint32_t i = 0; i < words; i++) {
+			CRC->DR = __REV(__UNALIGNED_UINT32_READ(&data[i * 4]));
+		}
+	}
+
+	return crc32_update_sw(CRC->DR, &data[words * 4], len & 3U);
+#else
+	return crc32_update_sw(crc, data, len);
+#endif
+}
+
+/**
+ * @fn uint32_t crc32_preload_word(uint32_t)
+ * @brief Returns the word that brings a freshly reset CRC unit to a given CRC.
+ * 		  Feeding a word w gives F(0xFFFFFFFF ^ w), F being 32 shifts of the CRC
+ * 		  register; F is undone one shift at a time (the polynomial has bit 0 set,
+ * 		  so bit 0 of a shifted value tells whether the polynomial was applied).
+ *
+ * @param crc -> CRC the data register must hold.
+ * @return word to write to CRC->DR after CRC_CR_RESET.
+ */
+static uint32_t crc32_preload_word(uint32_t crc) {
+	for (uint8_t bit = 0; bit < 32; bit++) {
+		crc = (crc & 1U) ? ((crc ^ CRC32_POLYNOMIAL) >> 1) | 0x80000000UL : (crc >> 1);
+	}
+
+	return crc ^ CRC32_INIT;
+}
+
+/**
+ * @fn uint32_t crc32_update_words(uint32_t, const uint32_t*, uint32_t)
+ * @brief Continues a CRC-32/MPEG-2 computation over 32-bit words as stored in memory:
+ * 		  each word is shifted in MSB first, so every 4-byte group counts in reverse
+ * 		  byte order. DMA2 Stream0 feeds the words to the CRC unit; a transfer error
+ * 		  falls back to the CPU.
+ *
+ * @pre Same as crc32_compute(). DMA2 Stream0 is not used elsewhere.
+ * @param crc -> CRC of the preceding words, or CRC32_INIT.
+ * @param data -> first word (flash or RAM).
+ * @param words -> number of words.
+ * @return CRC of the preceding words followed by data.
+ */
+uint32_t crc32_update_words(uint32_t crc, const uint32_t *data, uint32_t words) {
+#ifdef CRC
+	CRC->CR = CRC_CR_RESET;
+	if (crc != CRC32_INIT) {
+		CRC->DR = crc32_preload_word(crc);
+	}
+	if (crc32_dma_feed(data, words) != 0) {
+		return CRC->DR;
+	}
+
+	CRC->CR = CRC_CR_RESET; // The failed transfer stopped at an unknown word: start again
+	if (crc != CRC32_INIT) {
+		CRC->DR = crc32_preload_word(crc);
+	}
+	for (uint32_t i = 0; i < words; i++) {
+		CRC->DR = data[i];
+	}
+
+	return CRC->DR;
+#else
+	for (uint32_t i = 0; i < words; i++) {
+		const uint8_t reversed[4] = { (uint8_t) (data[i] >> 24), (uint8_t) (data[i] >> 16),
+				(uint8_t) (data[i] >> 8), (uint8_t) data[i] };
+		crc = crc32_update_sw(crc, reversed, 4);
+	}
+
+	return crc;
+#endif
+}
+
+#ifdef CRC
+/**
+ * @fn uint8_t crc32_dma_feed(const uint32_t*, uint32_t)
+ * @brief Copies words to CRC->DR with DMA2 Stream0 in memory-to-memory mode, in
+ * 		  transfers of at most CRC32_DMA_CHUNK_WORDS, and polls each one to its end.
+ * 		  The next transfer is set up only after the stream is disabled again.
+ *
+ * @pre crc32_init() was called.
+ * @post The stream is disabled and its flags are cleared.
+ * @param data -> first word.
+ * @param words -> number of words.
+ * @return 1 if every word was transferred, 0 on a DMA transfer error.
+ */
+static uint8_t crc32_dma_feed(const uint32_t *data, uint32_t words) {
+	const uint32_t flags = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0
+			| DMA_LIFCR_CFEIF0;
+	uint8_t done = 1;
+
+	while ((words > 0) && done) {
+		uint32_t chunk = (words > CRC32_DMA_CHUNK_WORDS) ? CRC32_DMA_CHUNK_WORDS : words;
+
+		DMA2_Stream0->CR = 0;
+		while ((DMA2_Stream0->CR & DMA_SxCR_EN) != 0) {
+		}
+		DMA2->LIFCR = flags;
+		DMA2_Stream0->PAR = (uint32_t) data;       // Memory-to-memory: the source is the peripheral port
+		DMA2_Stream0->M0AR = (uint32_t) &CRC->DR;  // Fixed destination
+		DMA2_Stream0->NDTR = chunk;
+		DMA2_Stream0->FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH; // Memory-to-memory requires the FIFO
+		data += chunk;
+		words -= chunk;
+		DMA2_Stream0->CR = DMA_SxCR_DIR_1 | DMA_SxCR_PINC | DMA_SxCR_PSIZE_1 | DMA_SxCR_MSIZE_1 | DMA_SxCR_EN;
+
+		while ((DMA2->LISR & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)) == 0) {
+		}
+		done = ((DMA2->LISR & DMA_LISR_TEIF0) == 0);
+	}
+	DMA2_Stream0->CR = 0;
+	while ((DMA2_Stream0->CR & DMA_SxCR_EN) != 0) {
+	}
+	DMA2->LIFCR = flags;
+
+	return done;
+}
+#endif
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -25,25 +25,91 @@
 #include "string.h"
 #include "usb_handler.h" // For send_message
 #include "data_process.h"
+#include "write_buffer.h"
+#include "response_cache.h"
+#include "link.h"
+#include "decompress.h"
+#include "patch.h"
+#include "usbd_cdc_if.h" // For CDC_TxIdle_FS, CDC_TxRetry_FS
 /* External Functions --------------------------------------------------------*/
-extern uint8_t CDC_Transmit_FS(uint8_t *Buf, uint16_t Len);
+extern uint32_t CDC_TxFree_FS(void);
+/* Defines and Macros --------------------------------------------------------*/
+#define ACK_EVERY_DEFAULT (16)     // Ack mode: commands per cumulative ack when the host sends 0
+#define ACK_INTERVAL_DEFAULT (20)  // Ack mode: ms before a partial cumulative ack when the host sends 0
+#define ACK_WINDOW (32)            // Ack mode: command numbers after a gap that are tracked until it is filled
+#define JUMP_TX_TIMEOUT (100)      // ms the jump waits for the host to read its response, bounds the handoff
+/* Typedefs ------------------------------------------------------------------*/
+/**
+ * @struct BL_Ack_State_t
+ * @brief State of the cumulative acknowledgement mode (OPTION_ACK_MODE).
+ */
+typedef struct
+{
+    uint8_t enabled;        /**< 1 -> successful writes are acknowledged cumulatively */
+    uint8_t every;          /**< Send an ack after this many unacknowledged commands */
+    uint16_t interval;      /**< ... or this many ms after the first unacknowledged command */
+    uint16_t last;          /**< Highest contiguous command number: it and every earlier one is processed */
+    uint16_t highest;       /**< Highest command number processed, last if there is no gap */
+    uint32_t above;         /**< Bit i -> command last + 1 + i is processed (after a gap) */
+    uint16_t acked;         /**< Command number of the last cumulative ack */
+    uint16_t pending;       /**< Commands processed since the last ack */
+    uint32_t pending_tick;  /**< HAL_GetTick() of the first unacknowledged command */
+} BL_Ack_State_t;
 /* Variables -----------------------------------------------------------------*/
 uint8_t buff_tx[15];
+static BL_Ack_State_t ack_state;
 /* Prototypes ----------------------------------------------------------------*/
 void response_message(void);
 uint8_t process_data(void);
 void handle_error(BL_Error_Handler_e err);
 uint8_t read_process_data(uint32_t cmd_adress);
 uint8_t write_process_data(uint32_t unit_adress);
+uint8_t read_status(uint32_t page);
+uint8_t read_session_option(uint32_t option);
+uint8_t read_flash_crc(uint32_t address, uint32_t len);
+uint8_t write_session_option(uint32_t option);
+uint8_t write_status_to_error(uint8_t status);
+uint8_t erase_status_to_error(uint8_t status);
+uint8_t flush_status_to_error(void);
+void ack_process(void);
+static void ack_send(void);
+static void ack_check_sequence(void);
+static void ack_advance(void);
 /* Functions -----------------------------------------------------------------*/
 
 /**
  * @fn void response_message(void)
  * @brief If the command sent by the master is applied correctly and without errors,
  *        it sends back the message itself as a response.
+ *        In ack mode, TARGET_MEM_WRITE, TARGET_MEM_FLUSH and the LZ4/patch data frames are not echoed; they are
+ *        covered by the next cumulative ack (see ack_send()).
  */
 void response_message(void) {
 
+    if (ack_state.enabled) {
+        ack_check_sequence();
+        if ((m_message.target == TARGET_MEM_WRITE) || (m_message.target == TARGET_MEM_FLUSH)
+                || (m_message.target == TARGET_LZ4_DATA) || (m_message.target == TARGET_PATCH_DATA)) {
+            // Acknowledged by the next cumulative ack instead of an echo
+            if (ack_state.pending++ == 0) {
+                ack_state.pending_tick = HAL_GetTick();
+            }
+            ack_advance();
+            if (ack_state.pending >= ack_state.every) {
+                ack_send();
+            }
+            m_message.command_number.u16 = 0;
+            m_message.target = 0;
+            m_message.address.u32 = 0;
+            m_message.command_type = CMD_TYPE_UNKNOWN;
+            m_message.data_type = DATA_TYPE_UNKNOWN;
+            m_message.data.u32 = 0;
+            return;
+        }
+        ack_send(); // Earlier commands are acknowledged before this response
+        ack_advance();
+    }
+
     buff_tx[0] = BOOTLOADER_RESP_START_BYTE;
 
     buff_tx[1] = m_message.command_number.b[0];
@@ -63,7 +129,7 @@ void response_message(void) {
 
     buff_tx[14] = BOOTLOADER_RESP_END_BYTE;
 
-    CDC_Transmit_FS(buff_tx, 15);
+    link_send(buff_tx, 15);
 
     m_message.command_number.u16 = 0;
     m_message.target = 0;
@@ -76,16 +142,30 @@ void response_message(void) {
 /**
  * @fn void handle_error(BL_Error_Handler_e)
  * @brief Transmits errors that occur during parsing or processing of the command sent by the master.
+ *        In ack mode it is sent at once and acts as the selective NACK of the command number.
  *
  * @param err -> contains the relevant error number.
  */
 void handle_error(BL_Error_Handler_e err) {
+    if (ack_state.enabled) {
+        // The error response is the selective NACK of this command number.
+        // Frames rejected by the parser carry no command number.
+        uint8_t parsed = (m_message.command_type != CMD_TYPE_UNKNOWN);
+        if (parsed) {
+            ack_check_sequence();
+        }
+        ack_send();
+        if (parsed) {
+            ack_advance();
+        }
+    }
+
     buff_tx[0] = BOOTLOADER_RESP_START_BYTE;
 
     buff_tx[1] = m_message.command_number.b[0];
     buff_tx[2] = m_message.command_number.b[1];
     buff_tx[3] = m_message.target;
-    m_message.address.u32 = TARGET_INVALID;
+    m_message.address.u32 = (m_device.error_address != 0) ? m_device.error_address : TARGET_INVALID;
     buff_tx[4] = m_message.address.b[0];
     buff_tx[5] = m_message.address.b[1];
     buff_tx[6] = m_message.address.b[2];
@@ -95,13 +175,13 @@ void handle_error(BL_Error_Handler_e err) {
     m_message.data_type = DATA_TYPE_U8;
     buff_tx[9] = (uint8_t) m_message.data_type;
     buff_tx[10] = err;
-    buff_tx[11] = 0;
+    buff_tx[11] = m_device.error_info;
     buff_tx[12] = 0;
     buff_tx[13] = 0;
 
     buff_tx[14] = BOOTLOADER_RESP_END_BYTE;
 
-    CDC_Transmit_FS(buff_tx, 15);
+    link_send(buff_tx, 15);
 
     m_message.command_number.u16 = 0;
     m_message.target = 0;
@@ -110,6 +190,8 @@ void handle_error(BL_Error_Handler_e err) {
     m_message.data_type = DATA_TYPE_UNKNOWN;
     m_message.data.u32 = 0;
 
+    m_device.error_info = 0;
+    m_device.error_address = 0;
     m_device.error_counter += 1; // Stores error count in memory.
 }
 
@@ -120,16 +202,25 @@ void handle_error(BL_Error_Handler_e err) {
  * @post  Executes the command specified in m_message (erase, write, reset, etc.).
  * Sends a response back to the host via USB.
  * Updates m_device.last_error if an error occurs during processing.
+ * A retransmitted WRITE command (same command_number and content) is not executed again;
+ * its cached result is sent instead.
  * @param None (uses global m_message and m_device)
  * @retval None
  */
 uint8_t process_data(void) {
+    uint8_t err = BL_OK;
+
     switch (m_message.command_type) {
         case CMD_TYPE_READ:
             return read_process_data(m_message.target);
             break;
         case CMD_TYPE_WRITE:
-            return write_process_data(m_message.target);
+            if (response_cache_replay(&err)) {
+                return err; // Retransmission: answered again, flash is not touched
+            }
+            err = write_process_data(m_message.target);
+            response_cache_store(err);
+            return err;
             break;
         default:
             return BL_ERR_INVALID_CMD_TYPE;
@@ -137,6 +228,227 @@ uint8_t process_data(void) {
     }
 }
 
+/**
+ * @fn uint8_t read_status(uint32_t)
+ * @brief Loads the requested status page (BL_Status_Page_e) into the response payload.
+ *        STATUS_PAGE_ERASE: data[0] -> BL_Erase_State_e, data[1] -> erased sectors,
+ *        data[2] -> total sectors, data[3] -> failed sector (0xFF if none).
+ *
+ * @param page -> status page selected by the address field.
+ * @return BL_Error_Handler_e
+ */
+uint8_t read_status(uint32_t page) {
+    switch (page) {
+        case STATUS_PAGE_ERASE:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = (uint8_t) erase_progress.state;
+            m_message.data.b[1] = erase_progress.erased_sectors;
+            m_message.data.b[2] = erase_progress.total_sectors;
+            m_message.data.b[3] = erase_progress.failed_sector;
+            return BL_OK;
+        case STATUS_PAGE_DIFF_SKIPPED:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = diff_stats.words_skipped;
+            return BL_OK;
+        case STATUS_PAGE_DIFF_PROGRAMMED:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = diff_stats.words_programmed;
+            return BL_OK;
+        case STATUS_PAGE_DIFF_ERASES:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.u32 = diff_stats.erases_avoided | ((uint32_t) diff_stats.erases_done << 16);
+            return BL_OK;
+        case STATUS_PAGE_QUEUE:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = message_queue_depth();
+            m_message.data.b[1] = BL_MESSAGE_QUEUE_SIZE;
+            m_message.data.b[2] = (uint8_t) stream_free_space();
+            m_message.data.b[3] = (uint8_t) (stream_free_space() >> 8);
+            return BL_OK;
+        case STATUS_PAGE_IMAGE_CRC:
+            if ((app_check != APP_CHECK_OK) && (app_check != APP_CHECK_BAD_CRC)) {
+                return BL_ERR_NO_MANIFEST; // No CRC was computed
+            }
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = app_image_crc;
+            return BL_OK;
+        case STATUS_PAGE_DECOMPRESS:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = (uint8_t) decompress_progress.state;
+            m_message.data.b[1] = 0;
+            m_message.data.b[2] = (uint8_t) decompress_progress.blocks;
+            m_message.data.b[3] = (uint8_t) (decompress_progress.blocks >> 8);
+            return BL_OK;
+        case STATUS_PAGE_DECOMPRESS_OFFSET:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = decompress_progress.consumed;
+            return BL_OK;
+        case STATUS_PAGE_PATCH:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = (uint8_t) patch_progress.state;
+            m_message.data.b[1] = patch_progress.sector;
+            m_message.data.b[2] = (uint8_t) patch_progress.sectors;
+            m_message.data.b[3] = (uint8_t) (patch_progress.sectors >> 8);
+            return BL_OK;
+        case STATUS_PAGE_PATCH_OFFSET:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = patch_progress.consumed;
+            return BL_OK;
+        case STATUS_PAGE_BOOT_DECISION:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = boot_time.decision_us;
+            return BL_OK;
+        case STATUS_PAGE_BOOT_BRINGUP:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = boot_time.bringup_us;
+            return BL_OK;
+        case STATUS_PAGE_BOOT_HANDOFF:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = boot_time.handoff_us;
+            return BL_OK;
+        case STATUS_PAGE_APP_CHECK:
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = app_check | ((uint32_t) app_check_warm << 8);
+            return BL_OK;
+        case STATUS_PAGE_APP_VERSION:
+        case STATUS_PAGE_APP_BUILD_ID:
+            if (app_manifest() == NULL) {
+                return BL_ERR_NO_MANIFEST;
+            }
+            m_message.data_type = DATA_TYPE_U32;
+            m_message.data.u32 = (page == STATUS_PAGE_APP_VERSION) ? app_manifest()->version : app_manifest()->build_id;
+            return BL_OK;
+        default:
+            return BL_ERR_INVALID_ADDRESS;
+    }
+}
+
+/**
+ * @fn uint8_t read_flash_crc(uint32_t, uint32_t)
+ * @brief Loads the CRC-32 of a flash region into the response payload.
+ *        Buffered write data is programmed first, so the CRC covers everything sent.
+ *
+ * @param address -> first byte of the region.
+ * @param len -> number of bytes.
+ * @return BL_Error_Handler_e
+ */
+uint8_t read_flash_crc(uint32_t address, uint32_t len) {
+    uint32_t crc = 0;
+    uint8_t err = flush_status_to_error();
+
+    if (err != BL_OK) {
+        return err;
+    }
+    if (flash_region_crc(address, len, &crc) != HAL_OK) {
+        return BL_ERR_INVALID_ADDRESS;
+    }
+    m_message.data_type = DATA_TYPE_U32;
+    m_message.data.u32 = crc;
+
+    return BL_OK;
+}
+
+/**
+ * @fn uint8_t read_session_option(uint32_t)
+ * @brief Loads the value of a session option (BL_Session_Option_e) into the response payload.
+ *
+ * @param option -> session option selected by the address field.
+ * @return BL_Error_Handler_e
+ */
+uint8_t read_session_option(uint32_t option) {
+    switch (option) {
+        case OPTION_DIFF_WRITE:
+            m_message.data_type = DATA_TYPE_U8;
+            m_message.data.u32 = write_buffer_get_diff_mode();
+            return BL_OK;
+        case OPTION_ACK_MODE:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = ack_state.enabled;
+            m_message.data.b[1] = ack_state.every;
+            m_message.data.b[2] = (uint8_t) ack_state.interval;
+            m_message.data.b[3] = (uint8_t) (ack_state.interval >> 8);
+            return BL_OK;
+        case OPTION_LINK_MODE:
+            m_message.data_type = DATA_TYPE_BYTE_ARRAY;
+            m_message.data.b[0] = (uint8_t) link_get_mode();
+            m_message.data.b[1] = (uint8_t) LINK_CAPABILITIES;
+            m_message.data.b[2] = 0;
+            m_message.data.b[3] = 0;
+            return BL_OK;
+        default:
+            return BL_ERR_INVALID_ADDRESS;
+    }
+}
+
+/**
+ * @fn uint8_t write_session_option(uint32_t)
+ * @brief Sets a session option (BL_Session_Option_e) from the message payload.
+ *
+ * @param option -> session option selected by the address field.
+ * @return BL_Error_Handler_e
+ */
+uint8_t write_session_option(uint32_t option) {
+    switch (option) {
+        case OPTION_DIFF_WRITE:
+            write_buffer_set_diff_mode(m_message.data.b[0]);
+            return BL_OK;
+        case OPTION_ACK_MODE:
+            ack_send(); // Nothing stays unacknowledged across a mode change
+            ack_state.enabled = (m_message.data.b[0] != 0);
+            ack_state.every = (m_message.data.b[1] != 0) ? m_message.data.b[1] : ACK_EVERY_DEFAULT;
+            ack_state.interval = (uint16_t) (m_message.data.b[2] | (m_message.data.b[3] << 8));
+            if (ack_state.interval == 0) {
+                ack_state.interval = ACK_INTERVAL_DEFAULT;
+            }
+            ack_state.last = m_message.command_number.u16; // Command numbers continue from this command
+            ack_state.highest = ack_state.last;
+            ack_state.acked = ack_state.last;
+            ack_state.above = 0;
+            return BL_OK;
+        case OPTION_LINK_MODE:
+            // Answered in the current framing, the new one applies from the next frame on;
+            // stream_process() leaves the frames behind this one unparsed until then
+            return (link_set_mode(m_message.data.b[0]) == HAL_OK) ? BL_OK : BL_ERR_INVALID_DATA_TYPE;
+        default:
+            return BL_ERR_INVALID_ADDRESS;
+    }
+}
+
+/**
+ * @fn uint8_t write_status_to_error(uint8_t)
+ * @brief Converts the status of a write-buffer operation into a protocol error code.
+ *
+ * @param status -> HAL status, INVALID_SECTOR, DIFF_RESEND_SECTOR, a DECOMPRESS_ or a PATCH_ status.
+ * @return BL_Error_Handler_e
+ */
+uint8_t write_status_to_error(uint8_t status) {
+    switch (status) {
+        case HAL_OK:
+            return BL_OK;
+        case INVALID_SECTOR:
+            return BL_ERR_INVALID_ADDRESS;
+        case DIFF_RESEND_SECTOR:
+            m_device.error_info = diff_stats.resend_sector; // Host resends from the start of this sector
+            return BL_ERR_DIFF_RESEND;
+        case DECOMPRESS_INVALID_DATA:
+            return BL_ERR_DECOMPRESS;
+        case DECOMPRESS_OUT_OF_ORDER:
+            return BL_ERR_INVALID_ADDRESS; // Resend from the offset of STATUS_PAGE_DECOMPRESS_OFFSET
+        case PATCH_INVALID_DATA:
+            return BL_ERR_PATCH;
+        case PATCH_OLD_DIGEST:
+            m_device.error_info = 1; // Not the base of the patch: send the full image
+            return BL_ERR_PATCH;
+        case PATCH_NEW_DIGEST:
+            m_device.error_info = 2;
+            return BL_ERR_PATCH;
+        case PATCH_OUT_OF_ORDER:
+            return BL_ERR_INVALID_ADDRESS; // Resend from the offset of STATUS_PAGE_PATCH_OFFSET
+        default:
+            return BL_ERR_FLASH_WRITE;
+    }
+}
+
 /**
  * @fn uint8_t read_process_data(uint32_t)
  * @brief Handles the processing of the (read) command sent by the master.
@@ -156,10 +468,22 @@ uint8_t read_process_data(uint32_t unit_adress) {
         case TARGET_JUMP_APP:
             return BL_OK;
         case TARGET_GET_STATUS:
+            return read_status(m_message.address.u32);
+        case TARGET_MEM_FLUSH:
+            return BL_OK;
+        case TARGET_SESSION_OPTION:
+            return read_session_option(m_message.address.u32);
+        case TARGET_ERASE_RANGE:
+            return BL_OK;
+        case TARGET_FLASH_CRC:
+            return read_flash_crc(m_message.address.u32, m_message.data.u32);
+        case TARGET_LZ4_START:
+            return BL_OK;
+        case TARGET_LZ4_DATA:
             return BL_OK;
-        case UNIT_ADDRESS_6:
+        case TARGET_PATCH_START:
             return BL_OK;
-        case UNIT_ADDRESS_7:
+        case TARGET_PATCH_DATA:
             return BL_OK;
         default:
             return BL_ERR_INVALID_TARGET;
@@ -167,6 +491,162 @@ uint8_t read_process_data(uint32_t unit_adress) {
     return BL_ERR_INVALID_TARGET;
 }
 
+/**
+ * @fn uint8_t flush_status_to_error(void)
+ * @brief Programs the buffered write data (write_buffer_flush()) and converts its status
+ *        into a protocol error code. On an error the address field of the error response
+ *        holds the start of the data that did not reach flash; the host resends from there.
+ *        This also reports a line that failed earlier, while writes were being buffered.
+ *
+ * @return BL_Error_Handler_e
+ */
+uint8_t flush_status_to_error(void) {
+    uint8_t err = write_status_to_error(write_buffer_flush());
+
+    if (err != BL_OK) {
+        m_device.error_address = write_buffer_failed_address();
+    }
+    return err;
+}
+
+/**
+ * @fn uint8_t erase_status_to_error(uint8_t)
+ * @brief Maps the status of an erase request to a BL_Error_Handler_e code.
+ * 		  On success, data[2..3] of the response hold the sectors skipped because
+ * 		  they were already blank; progress is reported by TARGET_GET_STATUS.
+ *
+ * @param status -> return value of flash_erase_async() or flash_erase_range().
+ * @return BL_Error_Handler_e
+ */
+uint8_t erase_status_to_error(uint8_t status) {
+    switch (status) {
+        case HAL_OK:
+            m_message.data.b[2] = (uint8_t) erase_progress.skipped_mask;
+            m_message.data.b[3] = (uint8_t) (erase_progress.skipped_mask >> 8);
+            return BL_OK;
+        case HAL_BUSY:
+            return BL_ERR_FLASH_BUSY;
+        case INVALID_SECTOR:
+            return BL_ERR_INVALID_ADDRESS;
+        default:
+            return BL_ERR_FLASH_ERASE;
+    }
+}
+
+/**
+ * @fn void ack_send(void)
+ * @brief Sends the cumulative ack, if commands are waiting for one: command_number is the
+ *        highest contiguous command number (see ack_advance()), data[0..1] the number of
+ *        command numbers it covers since the previous ack. Failed commands in that range
+ *        have already been NACKed by handle_error(). Commands processed after a gap stay
+ *        unacknowledged until the gap is filled.
+ */
+static void ack_send(void) {
+    uint16_t covered = (uint16_t) (ack_state.last - ack_state.acked);
+
+    if ((ack_state.pending == 0) || (covered == 0)) {
+        return;
+    }
+
+    buff_tx[0] = BOOTLOADER_RESP_START_BYTE;
+    buff_tx[1] = (uint8_t) ack_state.last;
+    buff_tx[2] = (uint8_t) (ack_state.last >> 8);
+    buff_tx[3] = TARGET_ACK;
+    buff_tx[4] = 0;
+    buff_tx[5] = 0;
+    buff_tx[6] = 0;
+    buff_tx[7] = 0;
+    buff_tx[8] = (uint8_t) CMD_TYPE_RESPONSE;
+    buff_tx[9] = (uint8_t) DATA_TYPE_U16;
+    buff_tx[10] = (uint8_t) covered;
+    buff_tx[11] = (uint8_t) (covered >> 8);
+    buff_tx[12] = 0;
+    buff_tx[13] = 0;
+    buff_tx[14] = BOOTLOADER_RESP_END_BYTE;
+
+    link_send(buff_tx, 15);
+    ack_state.acked = ack_state.last;
+    ack_state.pending = (ack_state.above != 0) ? 1 : 0; // Commands after a gap wait for the next ack
+    ack_state.pending_tick = HAL_GetTick();
+}
+
+/**
+ * @fn void ack_check_sequence(void)
+ * @brief In ack mode, NACKs command numbers skipped between the highest processed command
+ *        and the current one (frames lost on the way) with BL_ERR_SEQUENCE: command_number
+ *        is the first missing one, data[2..3] the number of missing commands.
+ */
+static void ack_check_sequence(void) {
+    uint16_t expected = (uint16_t) (ack_state.highest + 1);
+    uint16_t missing = (uint16_t) (m_message.command_number.u16 - expected);
+
+    if ((missing == 0) || (missing >= 0x8000)) {
+        return; // In order, or a retransmission of an earlier command (possibly filling a gap)
+    }
+
+    ack_send();
+    buff_tx[0] = BOOTLOADER_RESP_START_BYTE;
+    buff_tx[1] = (uint8_t) expected;
+    buff_tx[2] = (uint8_t) (expected >> 8);
+    buff_tx[3] = TARGET_ACK;
+    buff_tx[4] = (uint8_t) TARGET_INVALID;
+    buff_tx[5] = 0;
+    buff_tx[6] = 0;
+    buff_tx[7] = 0;
+    buff_tx[8] = (uint8_t) CMD_TYPE_RESPONSE;
+    buff_tx[9] = (uint8_t) DATA_TYPE_U8;
+    buff_tx[10] = BL_ERR_SEQUENCE;
+    buff_tx[11] = 0;
+    buff_tx[12] = (uint8_t) missing;
+    buff_tx[13] = (uint8_t) (missing >> 8);
+    buff_tx[14] = BOOTLOADER_RESP_END_BYTE;
+
+    link_send(buff_tx, 15);
+    m_device.error_counter += 1;
+}
+
+/**
+ * @fn void ack_advance(void)
+ * @brief Marks the current command as processed. The highest contiguous command number
+ *        only moves across a gap once the missing commands have been retransmitted, so a
+ *        lost frame is never covered by a cumulative ack. A command more than ACK_WINDOW
+ *        numbers ahead gives up the oldest missing numbers, which were NACKed with
+ *        BL_ERR_SEQUENCE when the gap was seen.
+ */
+static void ack_advance(void) {
+    uint16_t ahead = (uint16_t) (m_message.command_number.u16 - ack_state.last);
+
+    if ((ahead == 0) || (ahead >= 0x8000)) {
+        return; // Retransmission of a command already covered
+    }
+    while (ahead > ACK_WINDOW) {
+        ack_state.last++;
+        ack_state.above >>= 1;
+        ahead--;
+    }
+    ack_state.above |= 1UL << (ahead - 1);
+    while (ack_state.above & 1) {
+        ack_state.last++;
+        ack_state.above >>= 1;
+    }
+    if ((int16_t) (m_message.command_number.u16 - ack_state.highest) > 0) {
+        ack_state.highest = m_message.command_number.u16;
+    }
+}
+
+/**
+ * @fn void ack_process(void)
+ * @brief Sends a partial cumulative ack once the oldest unacknowledged command has waited
+ *        for the ack interval. Called from the main loop.
+ */
+void ack_process(void) {
+    if ((ack_state.pending != 0) && (ack_state.last != ack_state.acked)
+            && (HAL_GetTick() - ack_state.pending_tick >= ack_state.interval)
+            && (CDC_TxFree_FS() >= LINK_RESPONSE_MAX_LENGTH)) {
+        ack_send();
+    }
+}
+
 /**
  * @fn uint8_t write_process_data(uint32_t)
  * @brief Handles the processing of the (write) command sent by the master.
@@ -177,25 +657,73 @@ uint8_t read_process_data(uint32_t unit_adress) {
  * @return BL_Error_Handler_e
  */
 uint8_t write_process_data(uint32_t unit_adress) {
+    uint8_t err = BL_OK;
 
     switch (unit_adress) {
         case TARGET_FLASH_ERASE :
-            return flash_erase(m_message.address.b[0], m_message.data.b[0]);
+            err = flush_status_to_error(); // Buffered data must reach flash before the erase
+            if (err != BL_OK) {
+                return err;
+            }
+            response_cache_reset(); // Results of earlier writes no longer describe the flash
+            return erase_status_to_error(flash_erase_async(m_message.address.b[0], m_message.data.b[0]));
+        case TARGET_ERASE_RANGE :
+            err = flush_status_to_error();
+            if (err != BL_OK) {
+                return err;
+            }
+            response_cache_reset();
+            return erase_status_to_error(flash_erase_range(m_message.address.u32, m_message.data.u32));
         case TARGET_MEM_WRITE:
-            return mem_write(m_message.data.b, m_message.address.u32, 4);
+            return write_status_to_error(write_buffer_write(m_message.payload, m_message.address.u32, m_message.data_length));
+        case TARGET_MEM_FLUSH:
+            return flush_status_to_error();
+        case TARGET_LZ4_START:
+            response_cache_reset();
+            return write_status_to_error(decompress_start(m_message.address.u32, m_message.data.u32));
+        case TARGET_LZ4_DATA:
+            err = write_status_to_error(decompress_feed(m_message.payload, m_message.address.u32, m_message.data_length));
+            m_message.data.u32 = m_message.data_length | ((uint32_t) decompress_progress.blocks << 16);
+            return err;
+        case TARGET_PATCH_START:
+            response_cache_reset();
+            return write_status_to_error(patch_start(m_message.payload, m_message.data_length));
+        case TARGET_PATCH_DATA:
+            err = write_status_to_error(patch_feed(m_message.payload, m_message.address.u32, m_message.data_length));
+            m_message.data.u32 = m_message.data_length | ((uint32_t) patch_progress.sectors << 16);
+            return err;
+        case TARGET_SESSION_OPTION:
+            return write_session_option(m_message.address.u32);
         case TARGET_JUMP_APP:
+            err = flush_status_to_error();
+            if (err != BL_OK) {
+                return err;
+            }
+            app_check = app_image_check(); // The image may have been written since boot
+            app_check_warm = 0;
+            if (app_check == APP_CHECK_BAD_CRC) {
+                m_device.error_info = (uint8_t) app_check;
+                return BL_ERR_CRC;
+            }
+#ifdef APP_MANIFEST_REQUIRED
+            if (app_check != APP_CHECK_OK) {
+#else
+            if ((app_check != APP_CHECK_OK) && (app_check != APP_CHECK_NO_MANIFEST)) {
+#endif
+                m_device.error_info = (uint8_t) app_check; // BL_App_Check_e
+                return BL_ERR_NO_MANIFEST;
+            }
             response_message();
-            HAL_Delay(100);
+            uint32_t tickstart = HAL_GetTick();
+            while (!CDC_TxIdle_FS() && (HAL_GetTick() - tickstart < JUMP_TX_TIMEOUT)) {
+                CDC_TxRetry_FS(); // the response is taken by the host before the USB is torn down
+            }
             jump_to_user_app();
             return BL_OK; // code should not come here
         case TARGET_CHIP_RESET:
             return BL_OK;
         case TARGET_GET_STATUS:
             return BL_OK;
-        case UNIT_ADDRESS_6:
-            return BL_OK;
-        case UNIT_ADDRESS_7:
-            return BL_OK;
         default:
             return BL_ERR_INVALID_TARGET;
     }
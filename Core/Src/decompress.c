@@ -0,0 +1,301 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : decompress.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Streaming LZ4 Decompressor
+ * @description    : Decodes a stream of LZ4 blocks, each preceded by a
+ *                   DECOMPRESS_BLOCK_HEADER_LENGTH byte header, one byte at a
+ *                   time, so a sequence may be split across any number of
+ *                   frames. Output bytes are kept in a DECOMPRESS_WINDOW_SIZE
+ *                   ring that serves as match history; each time the ring
+ *                   wraps, the completed window is handed to the
+ *                   write-combining buffer. Blocks may reference earlier
+ *                   blocks inside the window.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "string.h"
+#include "boot.h"
+#include "main.h"
+#include "write_buffer.h"
+#include "decompress.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define LZ4_MIN_MATCH (4)          // Match length encoded as 0 in the token
+#define LZ4_LENGTH_EXTENDED (15)   // Token nibble value followed by length bytes
+#define WINDOW_MASK (DECOMPRESS_WINDOW_SIZE - 1)
+/* Typedefs ------------------------------------------------------------------*/
+
+/**
+ * @enum BL_Lz4_Step_e
+ * @brief Field of the LZ4 stream the decoder expects next.
+ */
+typedef enum BL_Lz4_Step_e {
+	STEP_HEADER,          /**< Block header byte */
+	STEP_TOKEN,           /**< Sequence token: literal length (high nibble), match length (low nibble) */
+	STEP_LITERAL_LENGTH,  /**< Extra literal length byte */
+	STEP_LITERALS,        /**< Literal byte */
+	STEP_OFFSET,          /**< Match offset byte (u16, little endian) */
+	STEP_MATCH_LENGTH,    /**< Extra match length byte */
+	STEP_MATCH            /**< Match copy, needs no input */
+} BL_Lz4_Step_e;
+
+/**
+ * @struct BL_Lz4_Decoder_t
+ * @brief Decoder position inside the current block and sequence.
+ */
+typedef struct BL_Lz4_Decoder_t {
+	BL_Lz4_Step_e step;                            /**< Next expected field */
+	uint8_t field[DECOMPRESS_BLOCK_HEADER_LENGTH]; /**< Bytes of a header or offset received so far */
+	uint8_t field_count;                           /**< Number of bytes in field */
+	uint8_t token;                                 /**< Token of the current sequence */
+	uint32_t address;                              /**< Flash address of the first output byte */
+	uint32_t total;                                /**< Decompressed length of the stream */
+	uint32_t flushed;                              /**< Output bytes handed to the write buffer */
+	uint32_t block_in;                             /**< Compressed bytes left in the current block */
+	uint32_t block_end;                            /**< Value of produced at the end of the current block */
+	uint32_t length;                               /**< Literal or match bytes left */
+	uint32_t offset;                               /**< Match distance */
+} BL_Lz4_Decoder_t;
+/* Variables -----------------------------------------------------------------*/
+BL_Decompress_Progress_t decompress_progress = { 0 };
+static BL_Lz4_Decoder_t decoder = { 0 };
+static uint8_t window[DECOMPRESS_WINDOW_SIZE] __attribute__((aligned(4))); // Last output bytes, match history
+/* Prototypes ----------------------------------------------------------------*/
+uint8_t decompress_start(uint32_t address, uint32_t len);
+uint8_t decompress_feed(const uint8_t *data, uint32_t offset, uint32_t len);
+static uint8_t decompress_put(uint8_t byte);
+static uint8_t decompress_emit(void);
+static uint8_t decompress_advance(void);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn uint8_t decompress_start(uint32_t, uint32_t)
+ * @brief Starts a compressed-write stream. A running stream is dropped.
+ *
+ * @pre None. Unerased sectors are erased by the write buffer when output reaches them.
+ * @post decompress_progress.state is DECOMPRESS_RUNNING, the stream offset is 0.
+ * @param address -> flash address of the first decompressed byte.
+ * @param len -> decompressed length of the whole stream.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR if the output range is outside
+ * 		   the application area or empty.
+ */
+uint8_t decompress_start(uint32_t address, uint32_t len) {
+	memset(&decoder, 0, sizeof(decoder));
+	memset(&decompress_progress, 0, sizeof(decompress_progress));
+
+	if ((len == 0) || (flash_check_range(address, len) != HAL_OK)) {
+		return INVALID_SECTOR;
+	}
+	decoder.address = address;
+	decoder.total = len;
+	decoder.step = STEP_HEADER;
+	decompress_progress.state = DECOMPRESS_RUNNING;
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t decompress_feed(const uint8_t*, uint32_t, uint32_t)
+ * @brief Decodes the next part of the compressed stream. Bytes before the consumed
+ * 		  offset (a part the host sent again) are skipped.
+ *
+ * @pre decompress_start() was called.
+ * @post Decoded output is in the window or the write buffer. After the last block,
+ * 		 everything is programmed and the state is DECOMPRESS_DONE. On any error the
+ * 		 state is DECOMPRESS_ERROR and the stream must be restarted.
+ * @param data -> compressed bytes.
+ * @param offset -> position of data[0] in the compressed stream.
+ * @param len -> number of bytes.
+ * @return HAL_OK (0) if successful, DECOMPRESS_OUT_OF_ORDER if offset leaves a gap,
+ * 		   DECOMPRESS_INVALID_DATA for a malformed stream, otherwise the write buffer status.
+ */
+uint8_t decompress_feed(const uint8_t *data, uint32_t offset, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	if (decompress_progress.state != DECOMPRESS_RUNNING) {
+		return DECOMPRESS_INVALID_DATA;
+	}
+	if (offset > decompress_progress.consumed) {
+		return DECOMPRESS_OUT_OF_ORDER; // The stream stays usable, the host resends from consumed
+	}
+	if (decompress_progress.consumed - offset >= len) {
+		return HAL_OK; // Already decoded
+	}
+	data += decompress_progress.consumed - offset;
+	len -= decompress_progress.consumed - offset;
+
+	while ((len > 0) && (status == HAL_OK)) {
+		uint8_t byte = *data++;
+		len--;
+
+		if (decompress_progress.state != DECOMPRESS_RUNNING) {
+			status = DECOMPRESS_INVALID_DATA; // Data after the last block
+			break;
+		}
+		decompress_progress.consumed++;
+		if (decoder.step != STEP_HEADER) {
+			decoder.block_in--;
+		}
+
+		switch (decoder.step) {
+			case STEP_HEADER:
+				decoder.field[decoder.field_count++] = byte;
+				if (decoder.field_count == DECOMPRESS_BLOCK_HEADER_LENGTH) {
+					uint32_t raw = decoder.field[2] | ((uint32_t) decoder.field[3] << 8);
+
+					decoder.field_count = 0;
+					decoder.block_in = decoder.field[0] | ((uint32_t) decoder.field[1] << 8);
+					decoder.block_end = decompress_progress.produced + raw;
+					decoder.step = STEP_TOKEN;
+					if ((decoder.block_in == 0) || (raw > decoder.total - decompress_progress.produced)) {
+						status = DECOMPRESS_INVALID_DATA;
+					}
+				}
+				break;
+			case STEP_TOKEN:
+				decoder.token = byte;
+				decoder.length = byte >> 4;
+				decoder.step = (decoder.length == LZ4_LENGTH_EXTENDED) ? STEP_LITERAL_LENGTH : STEP_LITERALS;
+				break;
+			case STEP_LITERAL_LENGTH:
+			case STEP_MATCH_LENGTH:
+				decoder.length += byte;
+				if (byte != 0xFF) {
+					decoder.step = (decoder.step == STEP_LITERAL_LENGTH) ? STEP_LITERALS : STEP_MATCH;
+				}
+				break;
+			case STEP_LITERALS:
+				status = decompress_put(byte);
+				decoder.length--;
+				break;
+			case STEP_OFFSET:
+				decoder.field[decoder.field_count++] = byte;
+				if (decoder.field_count == 2) {
+					decoder.field_count = 0;
+					decoder.offset = decoder.field[0] | ((uint32_t) decoder.field[1] << 8);
+					decoder.length = (decoder.token & 0x0F) + LZ4_MIN_MATCH;
+					decoder.step = ((decoder.token & 0x0F) == LZ4_LENGTH_EXTENDED) ? STEP_MATCH_LENGTH : STEP_MATCH;
+				}
+				break;
+			default:
+				status = DECOMPRESS_INVALID_DATA;
+				break;
+		}
+
+		if (status == HAL_OK) {
+			status = decompress_advance();
+		}
+	}
+
+	if (status != HAL_OK) {
+		decompress_progress.state = DECOMPRESS_ERROR;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t decompress_advance(void)
+ * @brief Takes the steps that need no input: copies a complete match, closes a
+ * 		  finished literal run (next offset or end of block) and finishes the stream
+ * 		  after its last block. Validates lengths and offsets against the block.
+ *
+ * @return HAL_OK (0) if successful, DECOMPRESS_INVALID_DATA or the write buffer status.
+ */
+static uint8_t decompress_advance(void) {
+	uint8_t status = HAL_OK;
+
+	if (((decoder.step == STEP_LITERALS) || (decoder.step == STEP_MATCH))
+			&& (decoder.length > decoder.block_end - decompress_progress.produced)) {
+		return DECOMPRESS_INVALID_DATA; // Output would leave the block
+	}
+
+	if (decoder.step == STEP_MATCH) {
+		if ((decoder.offset == 0) || (decoder.offset > DECOMPRESS_WINDOW_SIZE)
+				|| (decoder.offset > decompress_progress.produced)) {
+			return DECOMPRESS_INVALID_DATA;
+		}
+		// Byte by byte: a match may overlap the bytes it produces
+		while ((decoder.length > 0) && (status == HAL_OK)) {
+			status = decompress_put(window[(decompress_progress.produced - decoder.offset) & WINDOW_MASK]);
+			decoder.length--;
+		}
+		decoder.step = STEP_TOKEN;
+	}
+
+	if ((decoder.step == STEP_LITERALS) && (decoder.length == 0)) {
+		if (decoder.block_in != 0) {
+			decoder.step = STEP_OFFSET;
+		} else { // A block ends with a literal-only sequence
+			if (decompress_progress.produced != decoder.block_end) {
+				return DECOMPRESS_INVALID_DATA;
+			}
+			decompress_progress.blocks++;
+			decoder.step = STEP_HEADER;
+			if (decompress_progress.produced == decoder.total) {
+				status = decompress_emit();
+				if (status == HAL_OK) {
+					status = write_buffer_flush();
+				}
+				if (status == HAL_OK) {
+					decompress_progress.state = DECOMPRESS_DONE;
+				}
+			}
+		}
+	}
+
+	if ((status == HAL_OK) && (decoder.step != STEP_HEADER) && (decoder.block_in == 0)) {
+		status = DECOMPRESS_INVALID_DATA; // Block data ends inside a sequence
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t decompress_put(uint8_t)
+ * @brief Appends one output byte to the window and hands the window to the write
+ * 		  buffer when it is full.
+ *
+ * @param byte -> decompressed byte.
+ * @return HAL_OK (0) if successful, otherwise the write buffer status.
+ */
+static uint8_t decompress_put(uint8_t byte) {
+	window[decompress_progress.produced & WINDOW_MASK] = byte;
+	decompress_progress.produced++;
+	if ((decompress_progress.produced & WINDOW_MASK) == 0) {
+		return decompress_emit();
+	}
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t decompress_emit(void)
+ * @brief Hands the output produced since the last call to the write buffer.
+ * 		  It is contiguous in the window, because the window is emitted whenever it wraps.
+ *
+ * @return HAL_OK (0) if successful, otherwise the write buffer status.
+ */
+static uint8_t decompress_emit(void) {
+	uint32_t len = decompress_progress.produced - decoder.flushed;
+	uint8_t status = HAL_OK;
+
+	if (len != 0) {
+		status = write_buffer_write(&window[decoder.flushed & WINDOW_MASK], decoder.address + decoder.flushed, len);
+		decoder.flushed = decompress_progress.produced;
+	}
+
+	return status;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,90 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : flash_program.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Flash Programming Engine
+ * @description    : Programs a buffer with the widest access its alignment
+ *                   allows: bytes and halfwords for the unaligned head and
+ *                   tail, 32-bit words for the aligned body. Only calls
+ *                   HAL_FLASH_Program(), so it also runs on the host against
+ *                   the simulated FLASH of Tools/flash_program.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "boot.h"
+#include "main.h"
+#include "flash_program.h"
+/* Prototypes ----------------------------------------------------------------*/
+uint8_t flash_program(const uint8_t *data, uint32_t address, uint32_t len);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn uint8_t flash_program(const uint8_t*, uint32_t, uint32_t)
+ * @brief Programs a buffer into flash using the widest access the alignment allows.
+ * 		  The unaligned head and tail are written as halfwords/bytes, the aligned body
+ * 		  as 32-bit words (PSIZE x32, valid for FLASH_VOLTAGE_RANGE_3 / 2.7V - 3.6V).
+ * 		  This needs 4 times fewer program operations than byte programming.
+ *
+ * @pre Flash memory must be unlocked and the target area erased. The caller records
+ * 		the range as written (flash_mark_written() in boot.c).
+ * @post Data is written to flash. Stops at the first failing program operation.
+ * @param data -> pointer to the source buffer (no alignment requirement).
+ * @param address -> destination flash address.
+ * @param len -> number of bytes to write.
+ * @return HAL_OK (0) if successful, otherwise the failing HAL status.
+ */
+BOOT_RAM_FUNC uint8_t flash_program(const uint8_t *data, uint32_t address, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	// Head: advance to a word boundary with byte/halfword accesses
+	while ((len > 0) && (address & 0x3) && (status == HAL_OK)) {
+		if (((address & 0x1) == 0) && (len >= 2)) {
+			status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address,
+					(uint16_t) (data[0] | (data[1] << 8)));
+			address += 2;
+			data += 2;
+			len -= 2;
+		} else {
+			status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, address, data[0]);
+			address += 1;
+			data += 1;
+			len -= 1;
+		}
+	}
+
+	// Body: aligned 32-bit words (source buffer may still be unaligned, so assemble the word)
+	while ((len >= 4) && (status == HAL_OK)) {
+		uint32_t word = (uint32_t) data[0] | ((uint32_t) data[1] << 8)
+				| ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, word);
+		address += 4;
+		data += 4;
+		len -= 4;
+	}
+
+	// Tail: remaining halfword and/or byte
+	if ((len >= 2) && (status == HAL_OK)) {
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, address,
+				(uint16_t) (data[0] | (data[1] << 8)));
+		address += 2;
+		data += 2;
+		len -= 2;
+	}
+	if ((len == 1) && (status == HAL_OK)) {
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, address, data[0]);
+	}
+
+	return status;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,173 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : link.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Link Layer (raw or COBS + CRC-32 framing)
+ * @description    : In LINK_MODE_COBS_CRC32 a frame and its CRC-32 are COBS
+ *                   encoded, so the 0x00 delimiter never occurs inside a frame.
+ *                   After corruption the receiver resynchronises at the next
+ *                   delimiter, and the CRC rejects frames with damaged bytes
+ *                   that the start/end byte check would accept. The mode is
+ *                   negotiated with the OPTION_LINK_MODE session option.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "link.h"
+#include "usbd_cdc_if.h"
+#include "crc32.h"
+/* Variables -----------------------------------------------------------------*/
+static BL_Link_Mode_e link_mode = LINK_MODE_RAW;          // Framing of the received and sent frames
+static BL_Link_Mode_e link_pending_mode = LINK_MODE_RAW;  // Applied by link_update() after the response
+/* Prototypes ----------------------------------------------------------------*/
+BL_Link_Mode_e link_get_mode(void);
+uint8_t link_set_mode(uint8_t mode);
+void link_update(void);
+void link_reset(void);
+uint8_t link_send(const uint8_t *frame, uint16_t len);
+uint16_t link_decode(uint8_t *buff, uint16_t len);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn BL_Link_Mode_e link_get_mode(void)
+ * @brief Returns the framing currently used on the link.
+ */
+BL_Link_Mode_e link_get_mode(void) {
+	return link_mode;
+}
+
+/**
+ * @fn uint8_t link_set_mode(uint8_t)
+ * @brief Requests a link mode. It takes effect in link_update(), after the response
+ *        to the requesting command has been sent in the old framing. The parser does
+ *        not parse past the requesting frame until then (see stream_process()).
+ *
+ * @param mode -> BL_Link_Mode_e
+ * @return HAL_OK (0) if the mode is supported, HAL_ERROR otherwise.
+ */
+uint8_t link_set_mode(uint8_t mode) {
+	if ((mode >= 32) || ((LINK_CAPABILITIES & (1U << mode)) == 0)) {
+		return HAL_ERROR;
+	}
+
+	link_pending_mode = (BL_Link_Mode_e) mode;
+	return HAL_OK;
+}
+
+/**
+ * @fn void link_update(void)
+ * @brief Applies a requested link mode. Called from the main loop after a command was answered.
+ */
+void link_update(void) {
+	link_mode = link_pending_mode;
+}
+
+/**
+ * @fn void link_reset(void)
+ * @brief Returns to LINK_MODE_RAW, e.g. when the host opens the port again.
+ */
+void link_reset(void) {
+	link_mode = LINK_MODE_RAW;
+	link_pending_mode = LINK_MODE_RAW;
+}
+
+/**
+ * @fn uint8_t link_send(const uint8_t*, uint16_t)
+ * @brief Queues a response frame for transmission in the current link mode.
+ *
+ * @param frame -> response frame, at most BL_FRAME_LENGTH bytes.
+ * @param len -> frame length.
+ * @return USBD_OK if queued, USBD_BUSY if the TX ring is full, USBD_FAIL if the frame is too long.
+ */
+uint8_t link_send(const uint8_t *frame, uint16_t len) {
+	uint8_t out[LINK_RESPONSE_MAX_LENGTH];
+	uint8_t raw[BL_FRAME_LENGTH + LINK_CRC_LENGTH];
+	uint16_t code_index = 0;
+	uint16_t out_len = 1;
+	uint8_t code = 1;
+
+	if (link_mode == LINK_MODE_RAW) {
+		return CDC_Queue_FS(frame, len);
+	}
+	if (len > BL_FRAME_LENGTH) {
+		return USBD_FAIL;
+	}
+
+	uint32_t crc = crc32_compute(frame, len);
+	for (uint16_t i = 0; i < len; i++) {
+		raw[i] = frame[i];
+	}
+	raw[len] = (uint8_t) crc;
+	raw[len + 1] = (uint8_t) (crc >> 8);
+	raw[len + 2] = (uint8_t) (crc >> 16);
+	raw[len + 3] = (uint8_t) (crc >> 24);
+
+	// COBS: every 0x00 is replaced by the distance to the next one
+	for (uint16_t i = 0; i < len + LINK_CRC_LENGTH; i++) {
+		if (raw[i] == 0) {
+			out[code_index] = code;
+			code_index = out_len++;
+			code = 1;
+		} else {
+			out[out_len++] = raw[i];
+			if (++code == 0xFF) {
+				out[code_index] = code;
+				code_index = out_len++;
+				code = 1;
+			}
+		}
+	}
+	out[code_index] = code;
+	out[out_len++] = LINK_DELIMITER;
+
+	return CDC_Queue_FS(out, out_len);
+}
+
+/**
+ * @fn uint16_t link_decode(uint8_t*, uint16_t)
+ * @brief Decodes a received COBS frame in place (without its delimiter) and checks its CRC-32.
+ *
+ * @param buff -> encoded frame, replaced by the decoded frame.
+ * @param len -> encoded length.
+ * @return length of the decoded frame without the CRC, or 0 if the encoding or the CRC is invalid.
+ */
+uint16_t link_decode(uint8_t *buff, uint16_t len) {
+	uint16_t in = 0;
+	uint16_t out = 0;
+
+	while (in < len) {
+		uint8_t code = buff[in++];
+		if ((code == 0) || (in + code - 1 > len)) {
+			return 0; // Invalid encoding
+		}
+		for (uint8_t i = 1; i < code; i++) {
+			buff[out++] = buff[in++];
+		}
+		if ((code != 0xFF) && (in < len)) {
+			buff[out++] = 0;
+		}
+	}
+
+	if (out <= LINK_CRC_LENGTH) {
+		return 0;
+	}
+	out -= LINK_CRC_LENGTH;
+	uint32_t crc = buff[out] | ((uint32_t) buff[out + 1] << 8) | ((uint32_t) buff[out + 2] << 16)
+			| ((uint32_t) buff[out + 3] << 24);
+	if (crc != crc32_compute(buff, out)) {
+		return 0;
+	}
+
+	return out;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
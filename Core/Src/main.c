@@ -26,6 +26,9 @@
 #include "usb_handler.h"
 #include "usbd_cdc_if.h"
 #include "data_process.h"
+#include "link.h"
+#include "response_cache.h"
+#include "crc32.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -48,11 +51,14 @@
 int looptick_boot = 0;
 int looptick_comm_status = 0;
 int looptick_com_status_counter = 0;
+static uint32_t rx_generation = 0; // CDC_RxGeneration_FS() the parser was last reset for
+static uint32_t port_opens = 0;    // CDC_PortOpens_FS() the session state was last reset for
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_NVIC_Init(void);
 /* USER CODE BEGIN PFP */
 /* USER CODE END PFP */
 
@@ -67,7 +73,8 @@ static void MX_GPIO_Init(void);
  */
 int main(void) {
     /* USER CODE BEGIN 1 */
-
+    address_selection(); // Boot decision on the reset clock: a valid application starts here, before any bring-up
+    uint32_t reset_clock_hz = SystemCoreClock;
     /* USER CODE END 1 */
 
     /* MCU Configuration--------------------------------------------------------*/
@@ -76,6 +83,7 @@ int main(void) {
     HAL_Init();
 
     /* USER CODE BEGIN Init */
+    crc32_init();
 
     /* USER CODE END Init */
 
@@ -83,14 +91,19 @@ int main(void) {
     SystemClock_Config();
 
     /* USER CODE BEGIN SysInit */
-
+    boot_time.bringup_us = boot_timer_lap(reset_clock_hz); // Counted on the reset clock, the PLL is selected at the very end
     /* USER CODE END SysInit */
 
     /* Initialize all configured peripherals */
     MX_GPIO_Init();
     MX_USB_DEVICE_Init();
+
+    /* Initialize interrupts */
+    MX_NVIC_Init();
     /* USER CODE BEGIN 2 */
-    address_selection();
+    boot_time.bringup_us += boot_timer_lap(SystemCoreClock);
+    HAL_GPIO_TogglePin(LED3_GPIO_Port, LED3_Pin); // Bootloader mode
+    vector_table_relocate(); // Staying in the bootloader: vector from SRAM during flash operations
     /* USER CODE END 2 */
 
     /* Infinite loop */
@@ -116,7 +129,23 @@ int main(void) {
             }
         }
 
-        if (m_device.message_state == MESSAGE_OK) // message arrived, check for errors!
+        if (CDC_RxGeneration_FS() != rx_generation) { // the port was initialised again by the host
+            rx_generation = CDC_RxGeneration_FS();
+            parser_reset();    // drops the frames of the earlier session
+        }
+        if (CDC_PortOpens_FS() != port_opens) { // the host opened the port
+            port_opens = CDC_PortOpens_FS();
+            link_reset();           // a new session starts in LINK_MODE_RAW
+            response_cache_reset(); // and with a new command numbering
+        }
+        flash_erase_process(); // starts the next sector of a background erase
+        stream_process();      // queues the received frames
+        ack_process();         // sends a due cumulative ack (ack mode)
+        CDC_TxRetry_FS();      // restarts a TX ring left pending by a failed transfer start
+
+        // message arrived, check for errors! Only taken when its response fits in the TX ring,
+        // so a host that stops reading responses stops command processing instead of losing responses.
+        if ((CDC_TxFree_FS() >= BL_RESPONSE_FRAMES_MAX * LINK_RESPONSE_MAX_LENGTH) && message_queue_pop())
                 {
             if (m_device.last_error == BL_OK) { // Mesaj onaylanmış ise işlemlere devam et
                 uint8_t err = process_data();
@@ -131,6 +160,8 @@ int main(void) {
                 // error messages will be published!
             }
             m_device.message_state = WAIT_FOR_MESSAGE; // message processed or error code returned, wait for new message!
+            message_queue_release(); // its frame is no longer needed
+            link_update(); // a link mode change applies after its response
         }
 
         if (HAL_GetTick() >= looptick_boot + 500) {
@@ -190,6 +221,16 @@ void SystemClock_Config(void) {
     HAL_RCC_EnableCSS();
 }
 
+/**
+ * @brief NVIC Configuration.
+ * @retval None
+ */
+static void MX_NVIC_Init(void) {
+    /* FLASH_IRQn interrupt configuration */
+    HAL_NVIC_SetPriority(FLASH_IRQn, 1, 0);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+}
+
 /**
  * @brief GPIO Initialization Function
  * @param None
@@ -20,16 +20,400 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "parser.h"
+#include "string.h"
+#include "usbd_cdc_if.h" // Received byte stream
+#include "link.h"
 /* Typedefs ------------------------------------------------------------------*/
 BL_Device_t m_device;
 BL_Message_Structure_t m_message;
 /* Defines and Macros --------------------------------------------------------*/
-#define MESSAGE_LENGTH (15)
+#define MESSAGE_LENGTH (BL_FRAME_LENGTH)
 #define NUM_VALID_COMMANDS_ADDRESS (7)
+#define DATA_TYPE_INDEX (9)     // data_type byte of the frame
+#define DATA_LENGTH_INDEX (10)  // data_length (u16, little endian) of a bulk frame
+/* Typedefs ------------------------------------------------------------------*/
+/**
+ * @struct BL_Queued_Message_t
+ * @brief A parsed message waiting in the command queue. Frames are parsed in place in
+ *        the USB OUT buffers, which stay in use until the message is processed (bulk
+ *        payloads point into them); a frame that is not contiguous there is copied to frame.
+ */
+typedef struct
+{
+	BL_Message_Structure_t message;      /**< Parsed message */
+	BL_Error_Handler_e error;            /**< Parse error, BL_OK if the message is valid */
+	uint32_t rx_start;                   /**< Stream position of the frame (CDC_RxPosition_FS()) */
+	uint8_t frame[LINK_FRAME_MAX_LENGTH]; /**< Copy of a frame that is not contiguous in the OUT buffers */
+} BL_Queued_Message_t;
+/* Variables -----------------------------------------------------------------*/
+static BL_Queued_Message_t message_queue[BL_MESSAGE_QUEUE_SIZE]; // Parsed messages waiting for the main loop
+static uint8_t queue_in = 0;             // Next free slot
+static uint8_t queue_out = 0;            // Oldest queued message
+static uint8_t queue_count = 0;          // Number of queued messages
+static bool queue_busy = false;          // The slot before queue_out is being processed (m_message.payload may point into it)
+static bool rx_resync = false;           // Set after a bad frame: further bad frames are dropped silently
+static uint32_t rx_scanned = 0;          // LINK_MODE_COBS_CRC32: stream bytes already searched for a delimiter
+static bool rx_barrier = false;          // A queued command changes the link mode: the bytes after it are parsed once it is processed
 /* Functions -----------------------------------------------------------------*/
 
+static void stream_release(void);
+
+/**
+ * @fn void message_queue_push(uint32_t)
+ * @brief Moves the message just parsed into m_message / m_device.last_error to the
+ *        free queue slot, and makes the parser ready for the next frame.
+ *
+ * @param rx_start -> stream position of its frame; the OUT buffers are kept from there on.
+ */
+static void message_queue_push(uint32_t rx_start)
+{
+	message_queue[queue_in].message = m_message;
+	message_queue[queue_in].error = m_device.last_error;
+	message_queue[queue_in].rx_start = rx_start;
+	queue_in = (uint8_t) ((queue_in + 1) % BL_MESSAGE_QUEUE_SIZE);
+	queue_count++;
+
+	memset(&m_message, 0, sizeof(m_message));
+	m_device.message_state = WAIT_FOR_MESSAGE;
+}
+
+/**
+ * @fn bool message_queue_pop(void)
+ * @brief Loads the oldest queued message into m_message / m_device.last_error.
+ *        Its slot stays reserved, so that a bulk payload keeps pointing at its frame,
+ *        until message_queue_release() is called.
+ *
+ * @pre Called from the main loop, no message is being processed.
+ * @post m_device.message_state is MESSAGE_OK if a message was loaded.
+ * @return true if a message was loaded, false if the queue is empty.
+ */
+bool message_queue_pop(void)
+{
+	if((queue_count == 0) || queue_busy)
+	{
+		return false;
+	}
+
+	m_message = message_queue[queue_out].message;
+	m_device.last_error = message_queue[queue_out].error;
+	queue_out = (uint8_t) ((queue_out + 1) % BL_MESSAGE_QUEUE_SIZE);
+	queue_count--;
+	queue_busy = true;
+	m_device.message_state = MESSAGE_OK;
+
+	return true;
+}
+
+/**
+ * @fn void message_queue_release(void)
+ * @brief Frees the slot of the message loaded by message_queue_pop() once it has been
+ *        processed, and the OUT buffers of its frame; stream_process() may then reuse them.
+ *
+ * @pre The message loaded by message_queue_pop() is processed and its response sent.
+ */
+void message_queue_release(void)
+{
+	queue_busy = false;
+	if(queue_count == 0)
+	{
+		rx_barrier = false; // Nothing is parsed after a link mode change, so it was the last one
+	}
+	stream_release();
+}
+
+/**
+ * @fn uint8_t message_queue_depth(void)
+ * @brief Returns the number of parsed messages waiting in the command queue.
+ */
+uint8_t message_queue_depth(void)
+{
+	return queue_count;
+}
+
+/**
+ * @fn uint16_t stream_free_space(void)
+ * @brief Returns the number of bytes the receive stream can still take.
+ */
+uint16_t stream_free_space(void)
+{
+	return (uint16_t) CDC_RxFree_FS();
+}
+
+/**
+ * @fn void stream_release(void)
+ * @brief Releases the OUT buffers before the oldest frame still in use, that is the frame
+ *        being processed or the oldest queued one; all consumed buffers if there is none.
+ */
+static void stream_release(void)
+{
+	uint32_t position = CDC_RxPosition_FS();
+
+	if(queue_busy)
+	{
+		position = message_queue[(queue_out + BL_MESSAGE_QUEUE_SIZE - 1) % BL_MESSAGE_QUEUE_SIZE].rx_start;
+	}
+	else if(queue_count != 0)
+	{
+		position = message_queue[queue_out].rx_start;
+	}
+	CDC_RxRelease_FS(position);
+}
+
+/**
+ * @fn bool stream_held(void)
+ * @brief Returns true if OUT buffers are held by queued frames, which frees them once processed.
+ */
+static bool stream_held(void)
+{
+	return (queue_count != 0) || queue_busy;
+}
+
+/**
+ * @fn void stream_reject(BL_Error_Handler_e, uint32_t)
+ * @brief Queues an error for a frame that cannot be parsed, once per run of bad frames,
+ *        and drops skip bytes of the stream so the next frame can be found.
+ */
+static void stream_reject(BL_Error_Handler_e err, uint32_t skip)
+{
+	if(!rx_resync)
+	{
+		m_device.last_error = err;
+		message_queue_push(CDC_RxPosition_FS());
+	}
+	rx_resync = true;
+	CDC_RxSkip_FS(skip);
+}
+
+/**
+ * @fn uint8_t* stream_frame(uint32_t, uint8_t*)
+ * @brief Returns the next len bytes of the stream in place, or copied to copy when they
+ *        are not contiguous in the OUT buffers.
+ */
+static uint8_t* stream_frame(uint32_t len, uint8_t *copy)
+{
+	uint8_t *frame = CDC_RxPeek_FS(len);
+
+	if(frame == NULL)
+	{
+		CDC_RxCopy_FS(copy, len);
+		frame = copy;
+	}
+	return frame;
+}
+
+/**
+ * @fn int32_t stream_next_raw(uint8_t**, uint8_t*)
+ * @brief LINK_MODE_RAW: scans for the start byte, reads the frame length from the header
+ *        and checks the end byte. Bytes outside frames are skipped.
+ *
+ * @param frame -> receives the frame (in the OUT buffers or in copy).
+ * @param copy -> LINK_FRAME_MAX_LENGTH bytes for a frame that is not contiguous.
+ * @return frame length, 0 if the frame is not complete yet, -1 if bytes were dropped.
+ */
+static int32_t stream_next_raw(uint8_t **frame, uint8_t *copy)
+{
+	uint8_t header[BL_BULK_HEADER_LENGTH];
+	uint32_t count = CDC_RxCount_FS();
+	uint32_t header_len = (count < BL_BULK_HEADER_LENGTH) ? count : BL_BULK_HEADER_LENGTH;
+
+	CDC_RxCopy_FS(header, header_len);
+	if((header_len != 0) && (header[0] != BOOTLOADER_RESP_START_BYTE))
+	{
+		CDC_RxSkip_FS(1); // Not a frame start
+		return -1;
+	}
+	uint32_t len = frame_length(header, (uint16_t) header_len);
+	if(len == 0)
+	{
+		return 0; // Header not complete yet
+	}
+	if(len > BL_FRAME_MAX_LENGTH)
+	{
+		stream_reject(BL_ERR_INVALID_DATA_SIZE, 1);
+		return -1;
+	}
+	if(count < len)
+	{
+		if((CDC_RxFree_FS() == 0) && !stream_held())
+		{
+			stream_reject(BL_ERR_INVALID_FORMAT, 1); // Sent in too many short packets to fit the OUT buffers
+			return -1;
+		}
+		return 0; // Rest of the frame not received yet
+	}
+
+	*frame = stream_frame(len, copy);
+	if((*frame)[len - 1] != BOOTLOADER_RESP_END_BYTE)
+	{
+		stream_reject(BL_ERR_INVALID_END, 1);
+		return -1;
+	}
+	CDC_RxSkip_FS(len);
+	return (int32_t) len;
+}
+
+/**
+ * @fn int32_t stream_next_cobs(uint8_t**, uint8_t*)
+ * @brief LINK_MODE_COBS_CRC32: takes the bytes up to the next delimiter, decodes them in
+ *        place and checks the CRC. A damaged frame only costs the bytes up to its delimiter.
+ *        Only bytes received since the last call are searched for the delimiter.
+ *
+ * @param frame -> receives the decoded frame (in the OUT buffers or in copy).
+ * @param copy -> LINK_FRAME_MAX_LENGTH bytes for a frame that is not contiguous.
+ * @return frame length, 0 if no delimiter was received yet, -1 if bytes were dropped.
+ */
+static int32_t stream_next_cobs(uint8_t **frame, uint8_t *copy)
+{
+	uint32_t count = CDC_RxCount_FS();
+	uint32_t len = (count < LINK_FRAME_MAX_LENGTH) ? count : LINK_FRAME_MAX_LENGTH;
+
+	if(len == rx_scanned)
+	{
+		return 0; // Nothing new since the last search
+	}
+	uint32_t end = CDC_RxFind_FS(LINK_DELIMITER, rx_scanned, len - rx_scanned);
+	if(end == CDC_RX_NOT_FOUND)
+	{
+		if((len == LINK_FRAME_MAX_LENGTH) || ((CDC_RxFree_FS() == 0) && !stream_held()))
+		{
+			rx_scanned = 0;
+			stream_reject(BL_ERR_INVALID_DATA_SIZE, len); // No delimiter within the longest frame
+			return -1;
+		}
+		rx_scanned = len;
+		return 0;
+	}
+
+	rx_scanned = 0;
+	if(end == 0)
+	{
+		CDC_RxSkip_FS(1);
+		return -1; // Empty frame, e.g. a delimiter sent by the host to flush a damaged frame
+	}
+	*frame = stream_frame(end, copy);
+	CDC_RxSkip_FS(end + 1);
+	len = link_decode(*frame, (uint16_t) end);
+	if(len == 0)
+	{
+		stream_reject(BL_ERR_CRC, 0);
+		return -1;
+	}
+	return (int32_t) len;
+}
+
+/**
+ * @fn bool stream_mode_change(void)
+ * @brief Returns true if the message just parsed into m_message selects a link mode
+ *        (TARGET_SESSION_OPTION / OPTION_LINK_MODE write). The frames after it use
+ *        the new framing, which applies once the command is processed (link_update()).
+ */
+static bool stream_mode_change(void)
+{
+	return (m_device.last_error == BL_OK) && (m_message.target == TARGET_SESSION_OPTION)
+			&& (m_message.command_type == CMD_TYPE_WRITE) && (m_message.address.u32 == OPTION_LINK_MODE);
+}
+
+/**
+ * @fn void stream_process(void)
+ * @brief Extracts the complete frames from the receive stream, parses them and queues
+ *        the results until the command queue is full. Frames may span packets and several
+ *        frames may share one packet; the framing depends on the link mode (see link.h).
+ *
+ *        Parsing stops after a link mode change until that command is processed, so
+ *        frames the host sends right behind it are parsed in the new framing.
+ *
+ * @pre Called from the main loop, no message is being processed.
+ * @post Every complete frame is queued, or the command queue is full, or a link mode
+ *       change is queued. OUT buffers that no queued frame uses are released.
+ */
+void stream_process(void)
+{
+	while(!rx_barrier && (queue_count + queue_busy < BL_MESSAGE_QUEUE_SIZE))
+	{
+		uint8_t *frame = NULL;
+		uint8_t *copy = message_queue[queue_in].frame;
+		uint32_t rx_start = CDC_RxPosition_FS();
+		int32_t len = (link_get_mode() == LINK_MODE_COBS_CRC32) ? stream_next_cobs(&frame, copy) : stream_next_raw(&frame, copy);
+
+		if(len == 0)
+		{
+			break;
+		}
+		if(len > 0)
+		{
+			rx_resync = false;
+			parse_message(frame, (uint16_t) len);
+			rx_barrier = stream_mode_change();
+			message_queue_push(rx_start);
+		}
+	}
+	stream_release();
+}
+
+/**
+ * @fn void parser_reset(void)
+ * @brief Drops what the parser holds from an earlier host session after the port was
+ *        initialised again (CDC_RxGeneration_FS() changed): queued messages and unparsed
+ *        bytes before CDC_RxSession_FS(), the delimiter search and the resync state.
+ *        CDC_Init_FS() runs in the USB interrupt and leaves the receive stream alone,
+ *        since the parser may be in the middle of it; the reset happens here instead.
+ *
+ * @pre Called from the main loop, no message is being processed.
+ */
+void parser_reset(void)
+{
+	uint32_t session = CDC_RxSession_FS();
+
+	while((queue_count != 0) && ((int32_t) (message_queue[queue_out].rx_start - session) < 0))
+	{
+		queue_out = (uint8_t) ((queue_out + 1) % BL_MESSAGE_QUEUE_SIZE);
+		queue_count--;
+	}
+	if((int32_t) (session - CDC_RxPosition_FS()) > 0)
+	{
+		CDC_RxSkip_FS(session - CDC_RxPosition_FS());
+		rx_scanned = 0;
+	}
+	rx_resync = false;
+	if(queue_count == 0)
+	{
+		rx_barrier = false; // The link mode change was dropped with its session
+	}
+	memset(&m_message, 0, sizeof(m_message));
+	m_device.message_state = WAIT_FOR_MESSAGE;
+	stream_release();
+}
+
 /**
- * @fn void parse_message(uint8_t*, uint8_t)
+ * @fn uint32_t frame_length(const uint8_t*, uint16_t)
+ * @brief Returns the total length of the frame that starts at buff, read from its header.
+ *        Fixed frames are MESSAGE_LENGTH bytes, bulk frames (DATA_TYPE_BYTE_ARRAY) are
+ *        BL_BULK_HEADER_LENGTH + data_length + 1 bytes.
+ *
+ * @param buff -> received bytes of the frame
+ * @param len -> number of received bytes
+ * @return frame length, or 0 if the header is not complete yet.
+ */
+uint32_t frame_length(const uint8_t *buff, uint16_t len)
+{
+	if(len <= DATA_TYPE_INDEX)
+	{
+		return 0;
+	}
+	if(buff[DATA_TYPE_INDEX] != DATA_TYPE_BYTE_ARRAY)
+	{
+		return MESSAGE_LENGTH;
+	}
+	if(len < BL_BULK_HEADER_LENGTH)
+	{
+		return 0;
+	}
+
+	return BL_BULK_HEADER_LENGTH + (uint32_t) (buff[DATA_LENGTH_INDEX] | (buff[DATA_LENGTH_INDEX + 1] << 8)) + 1;
+}
+
+/**
+ * @fn void parse_message(uint8_t*, uint16_t)
  * @brief Parses the message sent by the master and confirms its correctness
  *
  * @pre raw message is expected.
@@ -37,7 +421,7 @@ BL_Message_Structure_t m_message;
  * @param raw_buff -> unprocessed message
  * @param len -> size of the unprocessed message
  */
-void parse_message(uint8_t *raw_buff, uint8_t len)
+void parse_message(uint8_t *raw_buff, uint16_t len)
 {
 	if(m_device.message_state == WAIT_FOR_MESSAGE)  // Waiting for message.
 	{
@@ -51,11 +435,15 @@ void parse_message(uint8_t *raw_buff, uint8_t len)
 			m_device.last_error = BL_ERR_INVALID_END;
 		}
 
-		else if(len != MESSAGE_LENGTH) // Is the message size correct? // 15 Bytes
+		else if(frame_length(raw_buff, len) > BL_FRAME_MAX_LENGTH)
+		{
+			m_device.last_error = BL_ERR_INVALID_DATA_SIZE; // Bulk payload is larger than BL_BULK_PAYLOAD_MAX
+		}
+		else if(len != frame_length(raw_buff, len)) // Is the message size correct? // 15 Bytes, or header + data_length + 1 for bulk frames
 		{
 			m_device.last_error = BL_ERR_INVALID_FORMAT;
 		}
-		else if(raw_buff[0] == BOOTLOADER_RESP_START_BYTE && raw_buff[len - 1] == BOOTLOADER_RESP_END_BYTE && (len == MESSAGE_LENGTH)) // If the start, end, and size of the message are correct.
+		else if(raw_buff[0] == BOOTLOADER_RESP_START_BYTE && raw_buff[len - 1] == BOOTLOADER_RESP_END_BYTE) // If the start, end, and size of the message are correct.
 		{
 			pre_process_message(raw_buff);
 			m_device.last_error = BL_OK; // No error, preprocessing function was called.
@@ -92,11 +480,21 @@ void pre_process_message(uint8_t *buff)
 
 	m_message.data_type = buff[9];  // 0-> Unknown | 1 -> char | 2 -> u8 | 3 -> short | 4 -> u16 | 5 -> long | 6 -> u32 | 7 -> float
 
-	m_message.data.b[0] = buff[10];
-	m_message.data.b[1] = buff[11];
-	m_message.data.b[2] = buff[12];
-	m_message.data.b[3] = buff[13];
-
+	if(m_message.data_type == DATA_TYPE_BYTE_ARRAY) // Bulk frame: the payload stays in the receive buffer
+	{
+		m_message.data_length = (uint16_t) (buff[DATA_LENGTH_INDEX] | (buff[DATA_LENGTH_INDEX + 1] << 8));
+		m_message.payload = &buff[BL_BULK_HEADER_LENGTH];
+		m_message.data.u32 = m_message.data_length; // Echoed back as the number of bytes accepted
+	}
+	else
+	{
+		m_message.data.b[0] = buff[10];
+		m_message.data.b[1] = buff[11];
+		m_message.data.b[2] = buff[12];
+		m_message.data.b[3] = buff[13];
+		m_message.data_length = sizeof(m_message.data.b);
+		m_message.payload = m_message.data.b;
+	}
 }
 
 
@@ -0,0 +1,466 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : patch.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Delta Patch Engine
+ * @description    : Rebuilds the application from a stream of copy/insert
+ *                   operations against the resident image, one sector at a
+ *                   time. Sectors up to PATCH_STAGE_SIZE are built in RAM while
+ *                   the old content stays readable in flash, then written with
+ *                   mem_write_diff(): an unchanged sector is not touched and a
+ *                   sector is only erased for a 0->1 transition. Larger sectors
+ *                   are compared with the output as it arrives and left alone
+ *                   while it matches; at the first difference the old content
+ *                   is copied to PATCH_SCRATCH_SECTOR and the sector is erased
+ *                   and rewritten, copies from it then read the scratch copy.
+ *                   Copies from later sectors read the flash directly, copies
+ *                   from earlier (possibly rewritten) sectors are rejected, so
+ *                   the host diff must only reference old data at or after the
+ *                   sector being written. The old image CRC is checked before
+ *                   anything is changed, the new image CRC after the last
+ *                   operation.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "string.h"
+#include "boot.h"
+#include "main.h"
+#include "write_buffer.h"
+#include "patch.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define PATCH_ARGS_MAX (8) // Largest operation argument block (PATCH_OP_COPY)
+/* Typedefs ------------------------------------------------------------------*/
+
+/**
+ * @enum BL_Patch_Step_e
+ * @brief Field of the patch stream the engine expects next.
+ */
+typedef enum BL_Patch_Step_e {
+	STEP_OP,      /**< Operation code */
+	STEP_ARGS,    /**< Operation arguments */
+	STEP_INSERT   /**< Bytes of a PATCH_OP_INSERT */
+} BL_Patch_Step_e;
+
+/**
+ * @struct BL_Patch_Decoder_t
+ * @brief Position inside the patch stream and the expected images.
+ */
+typedef struct BL_Patch_Decoder_t {
+	BL_Patch_Step_e step;          /**< Next expected field */
+	uint8_t op;                    /**< Current operation code */
+	uint8_t args[PATCH_ARGS_MAX];  /**< Arguments received so far */
+	uint8_t arg_count;             /**< Number of bytes in args */
+	uint8_t arg_length;            /**< Argument bytes of the current operation */
+	uint32_t length;               /**< Insert bytes left */
+	uint32_t old_len;              /**< Length of the resident image */
+	uint32_t new_len;              /**< Length of the new image */
+	uint32_t new_crc;              /**< Expected CRC-32 of the new image */
+	uint8_t staged;                /**< Sector being rebuilt is built in stage[] */
+	uint8_t rewritten;             /**< Large sector: backed up and erased at its first difference */
+} BL_Patch_Decoder_t;
+/* Variables -----------------------------------------------------------------*/
+BL_Patch_Progress_t patch_progress = { .sector = INVALID_SECTOR_NUMBER };
+static BL_Patch_Decoder_t decoder = { 0 };
+static uint8_t stage[PATCH_STAGE_SIZE] __attribute__((section(".ccm_noinit"))); // New content of a small sector
+/* Prototypes ----------------------------------------------------------------*/
+uint8_t patch_start(const uint8_t *header, uint32_t len);
+uint8_t patch_feed(const uint8_t *data, uint32_t offset, uint32_t len);
+static uint8_t patch_operation(void);
+static uint8_t patch_copy(uint32_t offset, uint32_t length);
+static uint8_t patch_enter_sector(void);
+static uint8_t patch_leave_sector(void);
+static uint8_t patch_output(const uint8_t *data, uint32_t len);
+static uint8_t patch_rewrite_sector(uint32_t prefix);
+static uint32_t patch_sector_room(void);
+static uint8_t patch_finish(void);
+static uint32_t patch_read_u32(const uint8_t *buff);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn uint8_t patch_start(const uint8_t*, uint32_t)
+ * @brief Starts a patch after checking that the resident application is the image
+ * 		  the patch was computed against. A running patch is dropped.
+ *
+ * @pre None. Buffered write data is programmed first.
+ * @post patch_progress.state is PATCH_RUNNING, the stream offset is 0. Flash is unchanged.
+ * @param header -> PATCH_HEADER_LENGTH bytes: old length, old CRC-32, new length, new CRC-32
+ * 		  (u32, little endian, CRC-32 as computed by TARGET_FLASH_CRC).
+ * @param len -> number of header bytes.
+ * @return HAL_OK (0) if successful, PATCH_INVALID_DATA for a bad header, INVALID_SECTOR
+ * 		   if an image reaches PATCH_SCRATCH_SECTOR, PATCH_OLD_DIGEST if the resident
+ * 		   image differs, otherwise the write buffer status.
+ */
+uint8_t patch_start(const uint8_t *header, uint32_t len) {
+	uint32_t limit = flash_sectors[PATCH_SCRATCH_SECTOR].address - APP_START_BASE_ADDRESS;
+	uint32_t crc = 0;
+	uint8_t status = HAL_OK;
+
+	memset(&decoder, 0, sizeof(decoder));
+	memset(&patch_progress, 0, sizeof(patch_progress));
+	patch_progress.sector = INVALID_SECTOR_NUMBER;
+
+	if (len != PATCH_HEADER_LENGTH) {
+		return PATCH_INVALID_DATA;
+	}
+	decoder.old_len = patch_read_u32(&header[0]);
+	decoder.new_len = patch_read_u32(&header[8]);
+	decoder.new_crc = patch_read_u32(&header[12]);
+	if ((decoder.old_len > limit) || (decoder.new_len == 0) || (decoder.new_len > limit)) {
+		return INVALID_SECTOR;
+	}
+
+	status = write_buffer_flush();
+	if (status != HAL_OK) {
+		return status;
+	}
+	status = flash_region_crc(APP_START_BASE_ADDRESS, decoder.old_len, &crc);
+	if (status != HAL_OK) {
+		return status;
+	}
+	if (crc != patch_read_u32(&header[4])) {
+		return PATCH_OLD_DIGEST;
+	}
+
+	decoder.step = STEP_OP;
+	patch_progress.state = PATCH_RUNNING;
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t patch_feed(const uint8_t*, uint32_t, uint32_t)
+ * @brief Applies the next part of the patch stream. Bytes before the consumed offset
+ * 		  (a part the host sent again) are skipped.
+ *
+ * @pre patch_start() was called.
+ * @post The operations are applied. After the last one, the new image is programmed and
+ * 		 verified and the state is PATCH_DONE. On any error the state is PATCH_ERROR; the
+ * 		 application must then be written again (full image).
+ * @param data -> patch bytes.
+ * @param offset -> position of data[0] in the patch stream.
+ * @param len -> number of bytes.
+ * @return HAL_OK (0) if successful, PATCH_OUT_OF_ORDER if offset leaves a gap,
+ * 		   PATCH_INVALID_DATA, PATCH_NEW_DIGEST, INVALID_SECTOR or the flash status.
+ */
+uint8_t patch_feed(const uint8_t *data, uint32_t offset, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	if (patch_progress.state != PATCH_RUNNING) {
+		return PATCH_INVALID_DATA;
+	}
+	if (offset > patch_progress.consumed) {
+		return PATCH_OUT_OF_ORDER; // The patch stays usable, the host resends from consumed
+	}
+	if (patch_progress.consumed - offset >= len) {
+		return HAL_OK; // Already applied
+	}
+	data += patch_progress.consumed - offset;
+	len -= patch_progress.consumed - offset;
+
+	while ((len > 0) && (status == HAL_OK)) {
+		uint32_t chunk = 1;
+
+		if (patch_progress.state != PATCH_RUNNING) {
+			status = PATCH_INVALID_DATA; // Data after the last operation
+			break;
+		}
+
+		switch (decoder.step) {
+			case STEP_OP:
+				decoder.op = *data;
+				decoder.arg_count = 0;
+				decoder.arg_length = (decoder.op == PATCH_OP_COPY) ? 8 : ((decoder.op == PATCH_OP_INSERT) ? 4 : 0);
+				decoder.step = STEP_ARGS;
+				if (decoder.arg_length == 0) {
+					status = PATCH_INVALID_DATA;
+				}
+				break;
+			case STEP_ARGS:
+				decoder.args[decoder.arg_count++] = *data;
+				if (decoder.arg_count == decoder.arg_length) {
+					status = patch_operation();
+				}
+				break;
+			case STEP_INSERT:
+				status = patch_enter_sector();
+				chunk = len;
+				if (chunk > decoder.length) {
+					chunk = decoder.length;
+				}
+				if (chunk > patch_sector_room()) {
+					chunk = patch_sector_room();
+				}
+				if (status == HAL_OK) {
+					status = patch_output(data, chunk);
+				}
+				patch_progress.produced += chunk;
+				decoder.length -= chunk;
+				if (decoder.length == 0) {
+					decoder.step = STEP_OP;
+				}
+				break;
+			default:
+				status = PATCH_INVALID_DATA;
+				break;
+		}
+
+		data += chunk;
+		len -= chunk;
+		patch_progress.consumed += chunk;
+
+		if ((status == HAL_OK) && (decoder.step == STEP_OP) && (patch_progress.produced == decoder.new_len)) {
+			status = patch_finish();
+		}
+	}
+
+	if (status != HAL_OK) {
+		patch_progress.state = PATCH_ERROR;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t patch_operation(void)
+ * @brief Validates the operation whose arguments are complete and runs a copy at once.
+ *
+ * @return HAL_OK (0) if successful, PATCH_INVALID_DATA, or the status of the copy.
+ */
+static uint8_t patch_operation(void) {
+	uint32_t left = decoder.new_len - patch_progress.produced;
+
+	decoder.step = STEP_OP;
+	if (decoder.op == PATCH_OP_COPY) {
+		uint32_t offset = patch_read_u32(&decoder.args[0]);
+		uint32_t length = patch_read_u32(&decoder.args[4]);
+
+		if ((length > left) || (offset > decoder.old_len) || (length > decoder.old_len - offset)) {
+			return PATCH_INVALID_DATA;
+		}
+		return patch_copy(offset, length);
+	}
+
+	decoder.length = patch_read_u32(&decoder.args[0]);
+	if (decoder.length > left) {
+		return PATCH_INVALID_DATA;
+	}
+	if (decoder.length != 0) {
+		decoder.step = STEP_INSERT;
+	}
+
+	return HAL_OK;
+}
+
+/**
+ * @fn uint8_t patch_copy(uint32_t, uint32_t)
+ * @brief Appends bytes of the old image to the new one. Old data of the sector being
+ * 		  rebuilt is read from the scratch copy once that sector was rewritten, otherwise
+ * 		  (and for later sectors) from flash.
+ *
+ * @param offset -> position of the first byte in the old image.
+ * @param length -> number of bytes.
+ * @return HAL_OK (0) if successful, PATCH_INVALID_DATA if the source was already
+ * 		   overwritten, otherwise the flash status.
+ */
+static uint8_t patch_copy(uint32_t offset, uint32_t length) {
+	uint8_t status = HAL_OK;
+
+	while ((length > 0) && (status == HAL_OK)) {
+		uint32_t source = APP_START_BASE_ADDRESS + offset;
+		uint8_t source_sector = flash_get_sector(source);
+		const BL_Flash_Sector_t *sector = &flash_sectors[source_sector];
+		uint32_t chunk = sector->address + sector->size - source;
+
+		status = patch_enter_sector();
+		if (status != HAL_OK) {
+			break;
+		}
+		if (source_sector < patch_progress.sector) {
+			return PATCH_INVALID_DATA; // Already rewritten
+		}
+		if ((source_sector == patch_progress.sector) && decoder.rewritten) {
+			source = flash_sectors[PATCH_SCRATCH_SECTOR].address + (source - sector->address);
+		}
+		if (chunk > length) {
+			chunk = length;
+		}
+		if (chunk > patch_sector_room()) {
+			chunk = patch_sector_room();
+		}
+
+		status = patch_output((const uint8_t*) source, chunk);
+		patch_progress.produced += chunk;
+		offset += chunk;
+		length -= chunk;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t patch_enter_sector(void)
+ * @brief Completes the previous sector when the output moves into the next one, and
+ * 		  selects how the new one is rebuilt: in stage[] if it fits, otherwise in place
+ * 		  from its first difference on. Nothing is erased here.
+ *
+ * @return HAL_OK (0) if successful, otherwise the status of patch_leave_sector().
+ */
+static uint8_t patch_enter_sector(void) {
+	uint8_t sector = flash_get_sector(APP_START_BASE_ADDRESS + patch_progress.produced);
+	uint8_t status = HAL_OK;
+
+	if (sector == patch_progress.sector) {
+		return HAL_OK;
+	}
+
+	status = patch_leave_sector(); // The previous sector is complete
+	patch_progress.sector = sector;
+	patch_progress.sectors++;
+	decoder.staged = (flash_sectors[sector].size <= PATCH_STAGE_SIZE);
+	decoder.rewritten = 0;
+
+	return status;
+}
+
+/**
+ * @fn uint8_t patch_leave_sector(void)
+ * @brief Programs the new content of the sector being rebuilt. A staged sector is
+ * 		  written with flash_sector_rewrite(), which leaves identical content untouched;
+ * 		  a large sector that never differed needs nothing.
+ *
+ * @return HAL_OK (0) if successful, otherwise the flash status.
+ */
+static uint8_t patch_leave_sector(void) {
+	if (patch_progress.sector == INVALID_SECTOR_NUMBER) {
+		return HAL_OK;
+	}
+	if (decoder.staged) {
+		decoder.staged = 0;
+		return flash_sector_rewrite(patch_progress.sector, stage,
+				APP_START_BASE_ADDRESS + patch_progress.produced - flash_sectors[patch_progress.sector].address);
+	}
+
+	return write_buffer_flush();
+}
+
+/**
+ * @fn uint8_t patch_output(const uint8_t*, uint32_t)
+ * @brief Appends bytes to the new image inside the sector being rebuilt.
+ *
+ * @param data -> new bytes; may point into the old content of the sector being rebuilt.
+ * @param len -> number of bytes, at most patch_sector_room().
+ * @return HAL_OK (0) if successful, otherwise the flash status.
+ */
+static uint8_t patch_output(const uint8_t *data, uint32_t len) {
+	const BL_Flash_Sector_t *sector = &flash_sectors[patch_progress.sector];
+	uint32_t address = APP_START_BASE_ADDRESS + patch_progress.produced;
+	uint8_t status = HAL_OK;
+
+	if (decoder.staged) {
+		memcpy(&stage[address - sector->address], data, len);
+		return HAL_OK;
+	}
+	if (!decoder.rewritten) {
+		if (memcmp(data, (const uint8_t*) address, len) == 0) {
+			return HAL_OK; // Flash already holds the new content
+		}
+		status = patch_rewrite_sector(address - sector->address);
+		if (((uint32_t) data >= sector->address) && ((uint32_t) data < sector->address + sector->size)) {
+			data = (const uint8_t*) (flash_sectors[PATCH_SCRATCH_SECTOR].address + ((uint32_t) data - sector->address));
+		}
+	}
+	if (status == HAL_OK) {
+		status = write_buffer_write(data, address, len);
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t patch_rewrite_sector(uint32_t)
+ * @brief First difference in a large sector: copies the old content that is still
+ * 		  needed to PATCH_SCRATCH_SECTOR, erases the sector and writes back the part of
+ * 		  the new image that matched so far.
+ *
+ * @param prefix -> bytes of the sector already produced (equal to the flash content).
+ * @return HAL_OK (0) if successful, otherwise the flash status.
+ */
+static uint8_t patch_rewrite_sector(uint32_t prefix) {
+	const BL_Flash_Sector_t *sector = &flash_sectors[patch_progress.sector];
+	uint32_t old_end = APP_START_BASE_ADDRESS + decoder.old_len;
+	uint32_t backup = prefix;
+	uint8_t status = HAL_OK;
+
+	if ((old_end > sector->address) && (old_end - sector->address > backup)) {
+		backup = old_end - sector->address; // Later copies may read the rest of the old content
+		if (backup > sector->size) {
+			backup = sector->size;
+		}
+	}
+	decoder.rewritten = 1;
+	if (backup != 0) {
+		status = flash_sector_backup(patch_progress.sector, PATCH_SCRATCH_SECTOR, backup);
+	}
+	if (status == HAL_OK) {
+		status = flash_erase(patch_progress.sector, 1); // Also marks it erased for the write buffer
+	}
+	if ((status == HAL_OK) && (prefix != 0)) {
+		status = write_buffer_write((const uint8_t*) flash_sectors[PATCH_SCRATCH_SECTOR].address, sector->address, prefix);
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint32_t patch_sector_room(void)
+ * @brief Returns the number of output bytes left in the sector being rebuilt.
+ */
+static uint32_t patch_sector_room(void) {
+	const BL_Flash_Sector_t *sector = &flash_sectors[patch_progress.sector];
+
+	return sector->address + sector->size - (APP_START_BASE_ADDRESS + patch_progress.produced);
+}
+
+/**
+ * @fn uint8_t patch_finish(void)
+ * @brief Programs the rest of the new image and compares its CRC-32 with the expected one.
+ *
+ * @post patch_progress.state is PATCH_DONE if the image matches.
+ * @return HAL_OK (0) if successful, PATCH_NEW_DIGEST, or the flash status.
+ */
+static uint8_t patch_finish(void) {
+	uint32_t crc = 0;
+	uint8_t status = patch_leave_sector();
+
+	if (status == HAL_OK) {
+		status = flash_region_crc(APP_START_BASE_ADDRESS, decoder.new_len, &crc);
+	}
+	if ((status == HAL_OK) && (crc != decoder.new_crc)) {
+		status = PATCH_NEW_DIGEST;
+	}
+	if (status == HAL_OK) {
+		patch_progress.state = PATCH_DONE;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint32_t patch_read_u32(const uint8_t*)
+ * @brief Reads a little-endian u32 from a byte buffer.
+ */
+static uint32_t patch_read_u32(const uint8_t *buff) {
+	return buff[0] | ((uint32_t) buff[1] << 8) | ((uint32_t) buff[2] << 16) | ((uint32_t) buff[3] << 24);
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,196 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : response_cache.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Response Cache for Retransmitted Commands
+ * @description    : A WRITE command that is received again with the same
+ *                   command_number and the same content (target, address,
+ *                   data type and payload) is a retransmission: its stored
+ *                   result is replayed instead of erasing or programming the
+ *                   flash again. The cache is reset by every erase, by a new
+ *                   decompress or patch session and when the host restarts its
+ *                   command numbering.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "data_models.h"
+#include "response_cache.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define FNV_OFFSET_BASIS (0x811C9DC5UL)
+#define FNV_PRIME (0x01000193UL)
+/* Typedefs ------------------------------------------------------------------*/
+/**
+ * @struct BL_Cached_Response_t
+ * @brief Result of one processed WRITE command.
+ */
+typedef struct
+{
+	uint8_t valid;              /**< Entry holds a result */
+	uint16_t command_number;    /**< command_number of the command */
+	uint32_t digest;            /**< Digest of the command content */
+	uint8_t err;                /**< BL_Error_Handler_e returned by the command */
+	uint8_t error_info;         /**< m_device.error_info of an error response */
+	BL_Data_Type_e data_type;   /**< Response data type */
+	uint32_t data;              /**< Response data */
+} BL_Cached_Response_t;
+/* Variables -----------------------------------------------------------------*/
+static BL_Cached_Response_t cache[RESPONSE_CACHE_SIZE];
+static uint8_t cache_next = 0;     // Entry replaced by the next store
+static uint32_t message_hash = 0;  // Digest of the current command, taken before it modifies m_message.data
+static uint16_t newest_number = 0; // Highest command_number seen since the last reset
+static uint8_t newest_valid = 0;   // newest_number holds a command number
+/* Prototypes ----------------------------------------------------------------*/
+uint8_t response_cache_replay(uint8_t *err);
+void response_cache_store(uint8_t err);
+void response_cache_reset(void);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn uint32_t message_digest(void)
+ * @brief FNV-1a digest of the content of m_message (target, address, data type and payload).
+ */
+static uint32_t message_digest(void) {
+	uint32_t hash = FNV_OFFSET_BASIS;
+	const uint8_t header[6] = { (uint8_t) m_message.target, m_message.address.b[0], m_message.address.b[1],
+			m_message.address.b[2], m_message.address.b[3], (uint8_t) m_message.data_type };
+
+	for (uint32_t i = 0; i < sizeof(header); i++) {
+		hash = (hash ^ header[i]) * FNV_PRIME;
+	}
+	for (uint32_t i = 0; i < m_message.data_length; i++) {
+		hash = (hash ^ m_message.payload[i]) * FNV_PRIME;
+	}
+
+	return hash;
+}
+
+/**
+ * @fn BL_Cached_Response_t *cache_find(uint16_t)
+ * @brief Returns the entry of the given command number, or NULL.
+ */
+static BL_Cached_Response_t *cache_find(uint16_t command_number) {
+	for (uint32_t i = 0; i < RESPONSE_CACHE_SIZE; i++) {
+		if (cache[i].valid && (cache[i].command_number == command_number)) {
+			return &cache[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @fn uint8_t response_cache_replay(uint8_t*)
+ * @brief Checks whether m_message is a retransmission of a cached command. If so, the
+ *        stored response data is loaded into m_message / m_device.error_info.
+ *        Only commands within RESPONSE_CACHE_WINDOW of the newest command are replayed;
+ *        command_number 0 or a larger backwards jump resets the cache.
+ *
+ * @pre m_message holds a parsed WRITE command.
+ * @post On a hit, the command must not be executed; *err is its stored result.
+ * @param err -> receives the stored BL_Error_Handler_e on a hit.
+ * @return 1 on a hit, 0 if the command must be executed.
+ */
+uint8_t response_cache_replay(uint8_t *err) {
+	uint16_t number = m_message.command_number.u16;
+	uint16_t behind = (uint16_t) (newest_number - number); // Distance behind the newest command
+
+	message_hash = message_digest();
+	if (newest_valid && (behind != 0) && ((number == 0) || ((behind < 0x8000U) && (behind >= RESPONSE_CACHE_WINDOW)))) {
+		response_cache_reset(); // Numbering restarted, cached numbers now belong to other commands
+	}
+	if (!newest_valid || (behind >= 0x8000U)) {
+		newest_number = number;
+		newest_valid = 1;
+		return 0; // Newer than every cached command
+	}
+
+	BL_Cached_Response_t *entry = cache_find(number);
+	if ((entry == NULL) || (entry->digest != message_hash)) {
+		return 0; // New command, or a command number reused for other content
+	}
+
+	*err = entry->err;
+	m_device.error_info = entry->error_info;
+	m_message.data_type = entry->data_type;
+	m_message.data.u32 = entry->data;
+
+	return 1;
+}
+
+/**
+ * @fn uint8_t response_final(uint8_t)
+ * @brief Returns 0 for a result that a retransmission of the same command may change:
+ *        a running erase, a sector that had to be erased for a differential write, or a
+ *        flash operation that failed. The command is then executed again.
+ */
+static uint8_t response_final(uint8_t err) {
+	switch (err) {
+	case BL_ERR_FLASH_BUSY:
+	case BL_ERR_DIFF_RESEND:
+	case BL_ERR_FLASH_ERASE:
+	case BL_ERR_FLASH_WRITE:
+	case BL_ERR_TIMEOUT:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/**
+ * @fn void response_cache_store(uint8_t)
+ * @brief Stores the result of the WRITE command in m_message after it was executed.
+ *        Only final results are stored (see response_final()).
+ *
+ * @pre response_cache_replay() returned 0 for this command; m_message holds its
+ *      response data, err its result.
+ * @param err -> BL_Error_Handler_e returned by the command.
+ */
+void response_cache_store(uint8_t err) {
+	if (!response_final(err)) {
+		return;
+	}
+
+	BL_Cached_Response_t *entry = cache_find(m_message.command_number.u16);
+
+	if (entry == NULL) {
+		entry = &cache[cache_next];
+		cache_next = (uint8_t) ((cache_next + 1) % RESPONSE_CACHE_SIZE);
+	}
+
+	if (!newest_valid || ((uint16_t) (m_message.command_number.u16 - newest_number) < 0x8000U)) {
+		newest_number = m_message.command_number.u16; // The command itself reset the cache
+		newest_valid = 1;
+	}
+	entry->valid = 1;
+	entry->command_number = m_message.command_number.u16;
+	entry->digest = message_hash;
+	entry->err = err;
+	entry->error_info = m_device.error_info;
+	entry->data_type = m_message.data_type;
+	entry->data = m_message.data.u32;
+}
+
+/**
+ * @fn void response_cache_reset(void)
+ * @brief Forgets every cached result. Called when the results no longer describe the
+ *        flash (an erase, a decompress or patch session) or the command numbering
+ *        restarts (port opened again, command_number 0 or a backwards jump).
+ */
+void response_cache_reset(void) {
+	for (uint32_t i = 0; i < RESPONSE_CACHE_SIZE; i++) {
+		cache[i].valid = 0;
+	}
+	cache_next = 0;
+	newest_valid = 0;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
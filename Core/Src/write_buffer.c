@@ -0,0 +1,180 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : write_buffer.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Flash Write-Combining Buffer
+ * @description    : Collects consecutive flash writes into an aligned RAM line
+ *                   so that the fixed unlock/program/lock and LED cost of
+ *                   mem_write() is paid once per line instead of once per
+ *                   4-byte message.
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "string.h"
+#include "boot.h"
+#include "main.h"
+#include "write_buffer.h"
+/* Variables -----------------------------------------------------------------*/
+static uint8_t line_data[WRITE_BUFFER_LINE_SIZE] __attribute__((aligned(4))); // Buffered bytes
+static uint32_t line_start = 0;                                                 // Flash address of line_data[0]
+static uint32_t line_count = 0;                                                 // Number of buffered bytes
+static uint8_t diff_mode = 0;                                                   // Non-zero -> lines are written with mem_write_diff()
+static uint32_t failed_address = 0;                                             // Start of the line dropped by the last failing explicit flush
+/* Prototypes ----------------------------------------------------------------*/
+uint8_t write_buffer_write(const uint8_t *data, uint32_t address, uint32_t len);
+uint8_t write_buffer_flush(void);
+void write_buffer_set_diff_mode(uint8_t enable);
+uint8_t write_buffer_get_diff_mode(void);
+uint32_t write_buffer_failed_address(void);
+static uint8_t write_buffer_program(void);
+/* Functions -----------------------------------------------------------------*/
+
+/**
+ * @fn uint8_t write_buffer_write(const uint8_t*, uint32_t, uint32_t)
+ * @brief Queues data for programming. The data is copied into the current line,
+ * 		  flushing first if the address does not continue the buffered data or
+ * 		  crosses into another line, and flushing after if the line is full.
+ *
+ * 		  A line that fails to program stays buffered with its error: a full line
+ * 		  does not fail the write that filled it, since its data is buffered. The
+ * 		  error is returned when the line must make room for other data (it is tried
+ * 		  again first) or by the next write_buffer_flush(), which reports its address.
+ *
+ * @pre None. Unerased sectors are erased when the line is flushed.
+ * @post Data is buffered or programmed into flash.
+ * @param data -> pointer to the data to be written.
+ * @param address -> flash address of the first byte.
+ * @param len -> number of bytes to write.
+ * @return HAL_OK (0) if successful, INVALID_SECTOR if the range is outside the
+ * 		   application area, otherwise the status of the buffered line, which
+ * 		   could not be programmed to make room for the data.
+ */
+uint8_t write_buffer_write(const uint8_t *data, uint32_t address, uint32_t len) {
+	uint8_t status = flash_check_range(address, len);
+
+	while ((len > 0) && (status == HAL_OK)) {
+		uint32_t line_end = (address & ~(uint32_t) (WRITE_BUFFER_LINE_SIZE - 1)) + WRITE_BUFFER_LINE_SIZE;
+
+		// Non-contiguous write, or a failed full line: program what is buffered before starting a new line
+		if ((line_count != 0) && ((address != line_start + line_count)
+				|| (((line_start + line_count) & (WRITE_BUFFER_LINE_SIZE - 1)) == 0))) {
+			status = write_buffer_program();
+			if (status != HAL_OK) {
+				break;
+			}
+		}
+		if (line_count == 0) {
+			line_start = address;
+		}
+
+		uint32_t chunk = line_end - address;
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(&line_data[line_count], data, chunk);
+		line_count += chunk;
+		address += chunk;
+		data += chunk;
+		len -= chunk;
+
+		if (line_start + line_count == line_end) { // Line is full
+			write_buffer_program(); // A failure keeps the line, see above
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t write_buffer_program(void)
+ * @brief Programs the buffered line into flash in a single unlock/program/lock pass.
+ * 		  Sectors that have not been erased in this session are erased first, unless
+ * 		  the differential mode is enabled (see mem_write_diff()).
+ *
+ * @pre None. Does nothing if the buffer is empty.
+ * @post Buffer is empty, or still holds the line if programming failed.
+ * @return HAL_OK (0) if successful, otherwise the mem_write() status.
+ */
+static uint8_t write_buffer_program(void) {
+	uint8_t status = HAL_OK;
+
+	if (line_count != 0) {
+		if (diff_mode) {
+			status = mem_write_diff(line_data, line_start, line_count);
+		} else {
+			status = flash_erase_on_demand(line_start, line_count); // First write into a sector erases it
+			if (status == HAL_OK) {
+				status = mem_write(line_data, line_start, line_count);
+			}
+		}
+		if (status == HAL_OK) {
+			line_count = 0;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint8_t write_buffer_flush(void)
+ * @brief Programs the buffered line into flash (explicit flush: TARGET_MEM_FLUSH, the
+ * 		  jump, an erase, a CRC read or the end of a compressed or patch stream).
+ * 		  A line that still fails, also one kept from an earlier implicit flush, is
+ * 		  dropped and its address is kept for write_buffer_failed_address(); the host
+ * 		  resends the data from there.
+ *
+ * @pre None. Does nothing if the buffer is empty.
+ * @post Buffer is empty.
+ * @return HAL_OK (0) if successful, otherwise the mem_write() status.
+ */
+uint8_t write_buffer_flush(void) {
+	uint8_t status = write_buffer_program();
+
+	if (status != HAL_OK) {
+		failed_address = line_start;
+		line_count = 0;
+	}
+
+	return status;
+}
+
+/**
+ * @fn uint32_t write_buffer_failed_address(void)
+ * @brief Returns the flash address of the line dropped by the last failing write_buffer_flush().
+ */
+uint32_t write_buffer_failed_address(void) {
+	return failed_address;
+}
+
+/**
+ * @fn void write_buffer_set_diff_mode(uint8_t)
+ * @brief Selects how lines are written: differential (mem_write_diff()) or
+ * 		  erase-on-demand followed by a plain mem_write().
+ *
+ * @post Buffered data is flushed with the previous mode first.
+ * @param enable -> non-zero to enable the differential mode.
+ */
+void write_buffer_set_diff_mode(uint8_t enable) {
+	write_buffer_flush();
+	diff_mode = (enable != 0);
+}
+
+/**
+ * @fn uint8_t write_buffer_get_diff_mode(void)
+ * @brief Returns 1 if the differential write mode is enabled, 0 otherwise.
+ */
+uint8_t write_buffer_get_diff_mode(void) {
+	return diff_mode;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
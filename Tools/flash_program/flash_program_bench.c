@@ -0,0 +1,322 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : flash_program_bench.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host check and benchmark of the flash programming engine
+ * @description    : Runs Core/Src/flash_program.c on the host. HAL_FLASH_Program()
+ *                   is replayed from stm32f4xx_hal_flash.c on a simulated FLASH
+ *                   register block (SR, CR): it waits for BSY, sets PSIZE and PG,
+ *                   writes the data and waits again. The simulated controller
+ *                   raises PGAERR for a misaligned access, PGPERR when the
+ *                   access size differs from PSIZE and PGSERR when PG is not set,
+ *                   and programming only clears bits.
+ *
+ *                   The engine is first checked for every destination and
+ *                   source alignment and every length up to 67 bytes (data,
+ *                   untouched neighbours, number of operations), and for
+ *                   stopping at a failing operation. Then program operations,
+ *                   register accesses and a modelled time are printed per
+ *                   write size for the engine and for one byte per operation
+ *                   (the former mem_write() loop). The time model counts
+ *                   t_prog per operation (STM32F407 datasheet: 16 us typical,
+ *                   100 us maximum, for x8, x16 and x32 parallelism) plus the
+ *                   CPU cycles of the HAL call and of every register access;
+ *                   the BSY poll loop is modelled as one read that lasts until
+ *                   the operation ends.
+ *
+ *                   gcc -O2 -Ihost -I../../Core/Inc -o flash_program_bench flash_program_bench.c ../../Core/Src/flash_program.c
+ *                   ./flash_program_bench
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include "boot.h"
+#include "main.h"
+#include "flash_program.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define FLASH_BASE_ADDRESS (0x08000000UL)  // F4_SECTOR_0
+#define FLASH_SIZE (0x100000UL)            // FLASH_TOTAL_SIZE
+#define APP_BASE_ADDRESS (0x08008000UL)    // APP_START_BASE_ADDRESS
+#define APP_AREA_SIZE (0x000F8000UL)       // APP_AREA_SIZE
+
+#define FLASH_SR_EOP (0x00000001UL)        // Register bits as in stm32f407xx.h
+#define FLASH_SR_WRPERR (0x00000010UL)
+#define FLASH_SR_PGAERR (0x00000020UL)
+#define FLASH_SR_PGPERR (0x00000040UL)
+#define FLASH_SR_PGSERR (0x00000080UL)
+#define FLASH_SR_BSY (0x00010000UL)
+#define FLASH_SR_ERRORS (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+#define FLASH_CR_PG (0x00000001UL)
+#define FLASH_CR_PSIZE (0x00000300UL)
+#define FLASH_CR_PSIZE_POS (8U)
+
+#define CORE_MHZ (168U)                    // SystemCoreClock of the bootloader
+#define TPROG_TYP_US (16U)                 // Datasheet t_prog, typical
+#define TPROG_MAX_US (100U)                // Datasheet t_prog, maximum
+#define HAL_CALL_CYCLES (40U)              // Call, __HAL_LOCK, TypeProgram dispatch, return
+#define REG_ACCESS_CYCLES (2U)             // One FLASH register access on AHB
+#define CHECK_LENGTH_MAX (67U)
+/* Variables -----------------------------------------------------------------*/
+/** Simulated FLASH interface registers (the part of FLASH_TypeDef the HAL program path uses). */
+static struct {
+	uint32_t SR;
+	uint32_t CR;
+	uint64_t busy_until; // Cycle at which the running operation completes
+} flash_regs;
+static uint8_t flash_memory[FLASH_SIZE];
+static uint64_t cycle = 0;          // Simulated CPU time
+static uint32_t tprog_cycles = TPROG_TYP_US * CORE_MHZ;
+static uint32_t program_ops = 0;    // HAL_FLASH_Program() calls
+static uint32_t register_accesses = 0;
+static uint32_t fail_at_op = 0;     // Non-zero -> this operation hits a write-protected address
+/* Functions -----------------------------------------------------------------*/
+
+static uint32_t flash_reg_read(const uint32_t *reg) {
+	cycle += REG_ACCESS_CYCLES;
+	register_accesses++;
+	if ((reg == &flash_regs.SR) && (flash_regs.SR & FLASH_SR_BSY)) {
+		if (cycle < flash_regs.busy_until) {
+			cycle = flash_regs.busy_until; // The BSY poll loop spins until the operation ends
+			return flash_regs.SR;
+		}
+		flash_regs.SR &= ~FLASH_SR_BSY;
+		flash_regs.SR |= FLASH_SR_EOP;
+	}
+	return *reg;
+}
+
+static void flash_reg_write(uint32_t *reg, uint32_t value) {
+	cycle += REG_ACCESS_CYCLES;
+	register_accesses++;
+	if (reg == &flash_regs.SR) {
+		flash_regs.SR &= ~(value & (FLASH_SR_EOP | FLASH_SR_ERRORS)); // rc_w1 flags
+	} else {
+		*reg = value;
+	}
+}
+
+/**
+ * @brief Memory write into the flash area as the controller handles it.
+ */
+static void flash_memory_write(uint32_t address, uint32_t data, uint32_t size) {
+	uint32_t psize = (flash_regs.CR & FLASH_CR_PSIZE) >> FLASH_CR_PSIZE_POS; // 0: x8, 1: x16, 2: x32
+
+	cycle += REG_ACCESS_CYCLES;
+	if ((flash_regs.CR & FLASH_CR_PG) == 0) {
+		flash_regs.SR |= FLASH_SR_PGSERR;
+		return;
+	}
+	if ((address & (size - 1)) != 0) {
+		flash_regs.SR |= FLASH_SR_PGAERR;
+		return;
+	}
+	if ((1U << psize) != size) {
+		flash_regs.SR |= FLASH_SR_PGPERR;
+		return;
+	}
+	if (program_ops == fail_at_op) {
+		flash_regs.SR |= FLASH_SR_WRPERR;
+		return;
+	}
+	for (uint32_t i = 0; i < size; i++) {
+		flash_memory[address - FLASH_BASE_ADDRESS + i] &= (uint8_t) (data >> (8 * i));
+	}
+	flash_regs.SR |= FLASH_SR_BSY;
+	flash_regs.busy_until = cycle + tprog_cycles;
+}
+
+/**
+ * @brief FLASH_WaitForLastOperation() of the HAL, without the timeout.
+ */
+static HAL_StatusTypeDef flash_wait_for_last_operation(void) {
+	while (flash_reg_read(&flash_regs.SR) & FLASH_SR_BSY) {
+	}
+	if (flash_reg_read(&flash_regs.SR) & FLASH_SR_EOP) {
+		flash_reg_write(&flash_regs.SR, FLASH_SR_EOP);
+	}
+	if (flash_reg_read(&flash_regs.SR) & FLASH_SR_ERRORS) {
+		flash_reg_write(&flash_regs.SR, FLASH_SR_ERRORS);
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+/**
+ * @brief HAL_FLASH_Program() of stm32f4xx_hal_flash.c on the simulated registers.
+ */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+	HAL_StatusTypeDef status;
+	uint32_t size = 1U << TypeProgram;
+
+	program_ops++;
+	cycle += HAL_CALL_CYCLES;
+	if ((Address < FLASH_BASE_ADDRESS) || (Address - FLASH_BASE_ADDRESS > FLASH_SIZE - size)) {
+		return HAL_ERROR; // IS_FLASH_ADDRESS()
+	}
+	status = flash_wait_for_last_operation();
+	if (status == HAL_OK) {
+		flash_reg_write(&flash_regs.CR, flash_reg_read(&flash_regs.CR) & ~FLASH_CR_PSIZE);
+		flash_reg_write(&flash_regs.CR, flash_reg_read(&flash_regs.CR) | (TypeProgram << FLASH_CR_PSIZE_POS));
+		flash_reg_write(&flash_regs.CR, flash_reg_read(&flash_regs.CR) | FLASH_CR_PG);
+		flash_memory_write(Address, (uint32_t) Data, size);
+		status = flash_wait_for_last_operation();
+		flash_reg_write(&flash_regs.CR, flash_reg_read(&flash_regs.CR) & ~FLASH_CR_PG);
+	}
+	return status;
+}
+
+/**
+ * @brief The former mem_write() loop: one byte per program operation.
+ */
+static uint8_t flash_program_bytes(const uint8_t *data, uint32_t address, uint32_t len) {
+	uint8_t status = HAL_OK;
+
+	for (uint32_t i = 0; (i < len) && (status == HAL_OK); i++) {
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, address + i, data[i]);
+	}
+	return status;
+}
+
+static void flash_reset(void) {
+	memset(flash_memory, 0xFF, sizeof(flash_memory));
+	memset(&flash_regs, 0, sizeof(flash_regs));
+	cycle = 0;
+	program_ops = 0;
+	register_accesses = 0;
+	fail_at_op = 0;
+}
+
+/**
+ * @brief Fewest operations for len bytes at address: bytes/halfwords up to the word
+ * 		  boundary, words, then a halfword and/or a byte.
+ */
+static uint32_t expected_ops(uint32_t address, uint32_t len) {
+	uint32_t ops = 0;
+
+	if ((address & 1) && (len > 0)) {
+		ops++;
+		address++;
+		len--;
+	}
+	if ((address & 2) && (len >= 2)) {
+		ops++;
+		address += 2;
+		len -= 2;
+	} else if ((address & 2) && (len == 1)) {
+		return ops + 1;
+	}
+	return ops + len / 4 + (len & 2) / 2 + (len & 1);
+}
+
+static int check_engine(void) {
+	static uint8_t source[CHECK_LENGTH_MAX + 4];
+	uint32_t cases = 0;
+
+	for (uint32_t i = 0; i < sizeof(source); i++) {
+		source[i] = (uint8_t) (0xA5 ^ (i * 37));
+	}
+	for (uint32_t dst = 0; dst < 4; dst++) {
+		for (uint32_t src = 0; src < 4; src++) {
+			for (uint32_t len = 0; len <= CHECK_LENGTH_MAX; len++) {
+				uint32_t address = APP_BASE_ADDRESS + 0x100 + dst;
+				uint8_t *cell = &flash_memory[address - FLASH_BASE_ADDRESS];
+
+				flash_reset();
+				if (flash_program(&source[src], address, len) != HAL_OK) {
+					printf("FAIL: dst+%u src+%u len %u returned an error\n", dst, src, len);
+					return 1;
+				}
+				if ((memcmp(cell, &source[src], len) != 0) || (cell[-1] != 0xFF) || (cell[len] != 0xFF)) {
+					printf("FAIL: dst+%u src+%u len %u programmed wrong data\n", dst, src, len);
+					return 1;
+				}
+				if (program_ops != expected_ops(address, len)) {
+					printf("FAIL: dst+%u src+%u len %u took %u operations, expected %u\n", dst, src, len,
+							program_ops, expected_ops(address, len));
+					return 1;
+				}
+				cases++;
+			}
+		}
+	}
+
+	// A failing operation stops the engine: nothing is programmed after it
+	for (uint32_t fail = 1; fail <= 8; fail++) {
+		uint32_t address = APP_BASE_ADDRESS + 0x101;
+
+		flash_reset();
+		fail_at_op = fail;
+		if ((flash_program(source, address, 32) != HAL_ERROR) || (program_ops != fail)) {
+			printf("FAIL: error at operation %u not reported or not stopped at (%u operations)\n", fail,
+					program_ops);
+			return 1;
+		}
+		cases++;
+	}
+
+	// Programming over data that is not erased only clears bits, as on the device
+	flash_reset();
+	memset(&flash_memory[APP_BASE_ADDRESS - FLASH_BASE_ADDRESS], 0x0F, 4);
+	flash_program(source, APP_BASE_ADDRESS, 4);
+	if (flash_memory[APP_BASE_ADDRESS - FLASH_BASE_ADDRESS] != (source[0] & 0x0F)) {
+		printf("FAIL: simulated flash set bits from 0 to 1\n");
+		return 1;
+	}
+
+	printf("OK: %u alignment/length/failure cases\n", cases + 1);
+	return 0;
+}
+
+static void bench_row(const char *name, uint32_t offset, uint32_t len,
+		uint8_t (*program)(const uint8_t*, uint32_t, uint32_t)) {
+	static uint8_t source[APP_AREA_SIZE];
+	uint32_t ops, accesses;
+	uint64_t cycles_typ, cycles_max;
+
+	flash_reset();
+	tprog_cycles = TPROG_MAX_US * CORE_MHZ;
+	program(source, APP_BASE_ADDRESS + offset, len);
+	cycles_max = cycle;
+	flash_reset();
+	tprog_cycles = TPROG_TYP_US * CORE_MHZ;
+	program(source, APP_BASE_ADDRESS + offset, len);
+	cycles_typ = cycle;
+	ops = program_ops;
+	accesses = register_accesses;
+
+	printf("%-6s %8u  +%-2u  %8u  %8.1f  %10.1f  %12.3f  %12.3f\n", name, len, offset, ops,
+			(double) ops * 1024.0 / len, (double) accesses * 1024.0 / len,
+			(double) cycles_typ / CORE_MHZ / 1000.0, (double) cycles_max / CORE_MHZ / 1000.0);
+}
+
+int main(void) {
+	static const uint32_t sizes[] = { 4, 16, 256, 1024, 65536, APP_AREA_SIZE - 4 };
+
+	if (check_engine() != 0) {
+		return 1;
+	}
+
+	printf("\n%-6s %8s  %3s  %8s  %8s  %10s  %12s  %12s\n", "engine", "bytes", "dst", "prog ops", "ops / KB",
+			"regs / KB", "ms (typ)", "ms (max)");
+	for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (uint32_t offset = 0; offset < 4; offset += 3) {
+			bench_row("byte", offset, sizes[i], flash_program_bytes);
+			bench_row("word", offset, sizes[i], flash_program);
+		}
+	}
+
+	return 0;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
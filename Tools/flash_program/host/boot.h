@@ -0,0 +1,26 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : boot.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host stand-in for Core/Inc/boot.h.
+ *
+ * @description    : Only what flash_program.c needs, so that it builds on the
+ *                   host. The code runs from host memory, BOOT_RAM_FUNC is
+ *                   empty.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_BOOT_H_
+#define INC_BOOT_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+#define BOOT_RAM_FUNC
+
+#endif /* INC_BOOT_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
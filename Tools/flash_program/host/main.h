@@ -0,0 +1,35 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : main.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host stand-in for Core/Inc/main.h.
+ *
+ * @description    : The part of stm32f4xx_hal_flash.h that flash_program.c
+ *                   uses. HAL_FLASH_Program() is provided by
+ *                   flash_program_bench.c on a simulated FLASH register block.
+ ******************************************************************************
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+typedef enum {
+	HAL_OK = 0x00U, HAL_ERROR = 0x01U, HAL_BUSY = 0x02U, HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define FLASH_TYPEPROGRAM_BYTE        0x00000000U  /*!< Program byte (8-bit) at a specified address           */
+#define FLASH_TYPEPROGRAM_HALFWORD    0x00000001U  /*!< Program a half-word (16-bit) at a specified address   */
+#define FLASH_TYPEPROGRAM_WORD        0x00000002U  /*!< Program a word (32-bit) at a specified address        */
+#define FLASH_TYPEPROGRAM_DOUBLEWORD  0x00000003U  /*!< Program a double word (64-bit) at a specified address */
+
+/* External functions --------------------------------------------------------*/
+extern HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+
+#endif /* __MAIN_H */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,30 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : boot.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host stand-in for Core/Inc/boot.h.
+ *
+ * @description    : Only what decompress.c needs, so that it builds on the
+ *                   host without the HAL. The flash is simulated by
+ *                   lz4_stream_test.c.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_BOOT_H_
+#define INC_BOOT_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Macros and Defines --------------------------------------------------------*/
+#define HAL_OK (0x00U)
+#define INVALID_SECTOR 0x04
+
+/* External functions --------------------------------------------------------*/
+extern uint8_t flash_check_range(uint32_t address, uint32_t len);
+
+#endif /* INC_BOOT_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
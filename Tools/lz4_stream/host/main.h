@@ -0,0 +1,17 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : main.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host stand-in for Core/Inc/main.h (nothing is needed).
+ ******************************************************************************
+ */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#endif /* __MAIN_H */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
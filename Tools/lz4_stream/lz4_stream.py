@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""
+******************************************************************************
+ @projectname    : Demo_Project_Parser
+ @filename       : lz4_stream.py
+ @author         : Omer Faruk ALMACI
+ @date           : Oct 16, 2026
+
+ @brief          : Host encoder for TARGET_LZ4_START / TARGET_LZ4_DATA
+ @description    : Writes the compressed stream decompress.c accepts: blocks of
+                   [compressed length u16][decompressed length u16] (little
+                   endian) followed by an LZ4 block. Match offsets never exceed
+                   DECOMPRESS_WINDOW_SIZE (4096), and matches may reach into
+                   earlier blocks. The stock lz4 tool cannot produce this: it
+                   writes the LZ4 frame format (frame header, block
+                   checksums, 64 KB match distance) instead.
+
+                   usage: lz4_stream.py image.bin image.lz4s [--block BYTES]
+******************************************************************************
+"""
+import argparse
+import struct
+import sys
+
+WINDOW_SIZE = 4096          # DECOMPRESS_WINDOW_SIZE in decompress.h
+MIN_MATCH = 4               # LZ4 minimum match length
+LAST_LITERALS = 5           # LZ4 block: the last 5 bytes are literals
+MATCH_SAFE_DISTANCE = 12    # LZ4 block: no match starts in the last 12 bytes
+CHAIN_DEPTH = 16            # Candidates tried per position
+BULK_HEADER_LENGTH = 12     # BL_BULK_HEADER_LENGTH, a bulk frame adds its end byte
+BULK_PAYLOAD_MAX = 1024     # BL_BULK_PAYLOAD_MAX
+
+
+def put_length(out, length):
+    """Appends the extra bytes of a literal or match length >= 15."""
+    length -= 15
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def put_sequence(out, literals, match_length, offset):
+    """Appends one LZ4 sequence; match_length 0 is the final literal-only sequence."""
+    extra = match_length - MIN_MATCH if match_length else 0
+    token = (min(len(literals), 15) << 4) | (min(extra, 15) if match_length else 0)
+    out.append(token)
+    if len(literals) >= 15:
+        put_length(out, len(literals))
+    out += literals
+    if match_length:
+        out += struct.pack("<H", offset)
+        if extra >= 15:
+            put_length(out, extra)
+
+
+def compress_block(data, start, end, chains):
+    """LZ4 block of data[start:end]. Matches may start anywhere in the window before."""
+    out = bytearray()
+    anchor = start
+    pos = start
+    match_limit = end - LAST_LITERALS
+
+    while pos + MATCH_SAFE_DISTANCE <= end:
+        key = bytes(data[pos:pos + MIN_MATCH])
+        candidates = chains.setdefault(key, [])
+        best_length = 0
+        best_offset = 0
+        for candidate in reversed(candidates):
+            offset = pos - candidate
+            if offset > WINDOW_SIZE:
+                break
+            length = MIN_MATCH
+            while (pos + length < match_limit) and (data[candidate + length] == data[pos + length]):
+                length += 1
+            if length > best_length:
+                best_length, best_offset = length, offset
+        candidates.append(pos)
+        if len(candidates) > CHAIN_DEPTH:
+            del candidates[0]
+
+        if best_length >= MIN_MATCH:
+            put_sequence(out, data[anchor:pos], best_length, best_offset)
+            for i in range(pos + 1, pos + best_length):  # Keep the chains complete inside the match
+                chain = chains.setdefault(bytes(data[i:i + MIN_MATCH]), [])
+                chain.append(i)
+                if len(chain) > CHAIN_DEPTH:
+                    del chain[0]
+            pos += best_length
+            anchor = pos
+        else:
+            pos += 1
+
+    put_sequence(out, data[anchor:end], 0, 0)
+    return out
+
+
+def compress_stream(data, block_size):
+    """Whole stream: every block with its 4-byte header."""
+    stream = bytearray()
+    chains = {}
+    for start in range(0, len(data), block_size):
+        end = min(start + block_size, len(data))
+        block = compress_block(data, start, end, chains)
+        stream += struct.pack("<HH", len(block), end - start) + block
+    return stream
+
+
+def wire_bytes(payload_length):
+    """Bytes sent in bulk frames of at most BULK_PAYLOAD_MAX payload bytes (raw link mode)."""
+    frames = (payload_length + BULK_PAYLOAD_MAX - 1) // BULK_PAYLOAD_MAX
+    return payload_length + frames * (BULK_HEADER_LENGTH + 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compress an image for TARGET_LZ4_DATA.")
+    parser.add_argument("image")
+    parser.add_argument("stream")
+    parser.add_argument("--block", type=int, default=16384, help="decompressed bytes per block (max 65535)")
+    args = parser.parse_args()
+    if not 0 < args.block <= 0xFFFF:
+        sys.exit("--block must be 1..65535")
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    stream = compress_stream(data, args.block)
+    with open(args.stream, "wb") as f:
+        f.write(stream)
+
+    print("image %d bytes -> stream %d bytes; on the wire %d (TARGET_MEM_WRITE) vs %d (TARGET_LZ4_DATA)"
+          % (len(data), len(stream), wire_bytes(len(data)), wire_bytes(len(stream))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : lz4_stream_test.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host round trip of the compressed-write stream
+ * @description    : Runs Core/Src/decompress.c on the host against a simulated
+ *                   flash behind write_buffer_write(), feeding a stream made by
+ *                   lz4_stream.py in TARGET_LZ4_DATA sized frames of random
+ *                   length, with some frames sent again from an earlier
+ *                   offset. The decoded flash is compared byte for byte with
+ *                   the image.
+ *
+ *                   gcc -Ihost -I../../Core/Inc -o lz4_stream_test lz4_stream_test.c ../../Core/Src/decompress.c
+ *                   ./lz4_stream.py image.bin image.lz4s && ./lz4_stream_test image.bin image.lz4s
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "boot.h"
+#include "write_buffer.h"
+#include "decompress.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define FLASH_BASE_ADDRESS (0x08008000UL)  // APP_START_BASE_ADDRESS
+#define FLASH_AREA_SIZE (0x000F8000UL)     // APP_AREA_SIZE
+#define FRAME_PAYLOAD_MAX (1024)           // BL_BULK_PAYLOAD_MAX
+#define FRAME_OVERHEAD (12 + 1)            // BL_BULK_HEADER_LENGTH + end byte
+/* Variables -----------------------------------------------------------------*/
+static uint8_t flash[FLASH_AREA_SIZE];
+/* Functions -----------------------------------------------------------------*/
+
+uint8_t flash_check_range(uint32_t address, uint32_t len) {
+	if ((address < FLASH_BASE_ADDRESS) || (len > FLASH_AREA_SIZE) || (address - FLASH_BASE_ADDRESS > FLASH_AREA_SIZE - len)) {
+		return INVALID_SECTOR;
+	}
+	return HAL_OK;
+}
+
+uint8_t write_buffer_write(const uint8_t *data, uint32_t address, uint32_t len) {
+	if (flash_check_range(address, len) != HAL_OK) {
+		return INVALID_SECTOR;
+	}
+	memcpy(&flash[address - FLASH_BASE_ADDRESS], data, len);
+	return HAL_OK;
+}
+
+uint8_t write_buffer_flush(void) {
+	return HAL_OK;
+}
+
+static uint8_t *read_file(const char *path, uint32_t *len) {
+	FILE *f = fopen(path, "rb");
+	uint8_t *data;
+	long size;
+
+	if (f == NULL) {
+		perror(path);
+		exit(2);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data = malloc((size_t) size + 1);
+	if ((data == NULL) || (fread(data, 1, (size_t) size, f) != (size_t) size)) {
+		perror(path);
+		exit(2);
+	}
+	fclose(f);
+	*len = (uint32_t) size;
+	return data;
+}
+
+static uint32_t wire_bytes(uint32_t payload) {
+	return payload + (payload + FRAME_PAYLOAD_MAX - 1) / FRAME_PAYLOAD_MAX * FRAME_OVERHEAD;
+}
+
+int main(int argc, char **argv) {
+	uint32_t image_len, stream_len, offset = 0, frames = 0, resent = 0;
+	uint8_t status;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s image.bin image.lz4s\n", argv[0]);
+		return 2;
+	}
+	uint8_t *image = read_file(argv[1], &image_len);
+	uint8_t *stream = read_file(argv[2], &stream_len);
+	srand(1);
+	memset(flash, 0xFF, sizeof(flash));
+
+	status = decompress_start(FLASH_BASE_ADDRESS, image_len);
+	if (status != HAL_OK) {
+		printf("FAIL: decompress_start returned %u\n", status);
+		return 1;
+	}
+	while (offset < stream_len) {
+		uint32_t len = 1 + (uint32_t) rand() % FRAME_PAYLOAD_MAX;
+		uint32_t start = offset;
+
+		if (len > stream_len - offset) {
+			len = stream_len - offset;
+		}
+		if ((offset > 16) && (rand() % 8 == 0)) {
+			start -= 1 + (uint32_t) rand() % 16; // Resent frame: the consumed part is skipped
+			resent++;
+		}
+		status = decompress_feed(&stream[start], start, offset + len - start);
+		if (status != HAL_OK) {
+			printf("FAIL: decompress_feed returned %u at offset %u (state %u)\n", status, offset,
+					decompress_progress.state);
+			return 1;
+		}
+		offset += len;
+		frames++;
+	}
+
+	if (decompress_progress.state != DECOMPRESS_DONE) {
+		printf("FAIL: state %u after the whole stream\n", decompress_progress.state);
+		return 1;
+	}
+	for (uint32_t i = 0; i < image_len; i++) {
+		if (flash[i] != image[i]) {
+			printf("FAIL: first difference at byte %u\n", i);
+			return 1;
+		}
+	}
+	printf("OK: %u bytes decoded from %u in %u frames (%u resent), %u blocks\n", image_len, stream_len, frames,
+			resent, decompress_progress.blocks);
+	printf("on the wire: %u bytes as TARGET_MEM_WRITE, %u as TARGET_LZ4_DATA\n", wire_bytes(image_len),
+			wire_bytes(stream_len));
+
+	return 0;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -0,0 +1,51 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @file           : boot.h
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host stand-in for Core/Inc/boot.h.
+ *
+ * @description    : Only what patch.c needs, so that it builds on the host
+ *                   without the HAL (STM32F407VG geometry). The flash and the
+ *                   functions below are simulated by patch_test.c.
+ ******************************************************************************
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef INC_BOOT_H_
+#define INC_BOOT_H_
+/* Includes ------------------------------------------------------------------*/
+#include "stdint.h"
+/* Typedefs ------------------------------------------------------------------*/
+
+/**
+ * @struct BL_Flash_Sector_t
+ * @brief Geometry of one flash sector.
+ */
+typedef struct
+{
+	uint32_t address; /**< Start address of the sector */
+	uint32_t size;    /**< Size of the sector in bytes */
+} BL_Flash_Sector_t;
+
+/* External variables --------------------------------------------------------*/
+extern const BL_Flash_Sector_t flash_sectors[];
+/* External functions --------------------------------------------------------*/
+extern uint8_t flash_erase(uint8_t sector_number, uint8_t number_of_sector);
+extern uint8_t flash_get_sector(uint32_t address);
+extern uint8_t flash_region_crc(uint32_t address, uint32_t len, uint32_t *crc);
+extern uint8_t flash_sector_backup(uint8_t sector, uint8_t scratch_sector, uint32_t len);
+extern uint8_t flash_sector_rewrite(uint8_t sector, const uint8_t *data, uint32_t len);
+/* Macros and Defines --------------------------------------------------------*/
+#define HAL_OK (0x00U)
+#define INVALID_SECTOR 0x04
+#define INVALID_SECTOR_NUMBER 0xFF
+#define TOTAL_SECTORS (12)
+#define APP_START_SECTOR (2)
+#define APP_START_BASE_ADDRESS (0x08008000UL)
+
+#endif /* INC_BOOT_H_ */
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
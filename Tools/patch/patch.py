@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""
+******************************************************************************
+ @projectname    : Demo_Project_Parser
+ @filename       : patch.py
+ @author         : Omer Faruk ALMACI
+ @date           : Oct 16, 2026
+
+ @brief          : Host encoder for TARGET_PATCH_START / TARGET_PATCH_DATA
+ @description    : Writes the delta patch patch.c accepts: the 16-byte
+                   TARGET_PATCH_START header ([old length][old CRC][new
+                   length][new CRC], u32 little endian, CRC-32 as computed
+                   by TARGET_FLASH_CRC) followed by the operation stream sent
+                   in TARGET_PATCH_DATA frames:
+                     0x01 [old offset u32][length u32]   copy from the old image
+                     0x02 [length u32][bytes]            insert new bytes
+                   The image is rebuilt in place, so a copy never reads old
+                   data before the start of the sector it writes into; such
+                   data is inserted instead. Copies are split at sector
+                   boundaries of the output.
+
+                   usage: patch.py old.bin new.bin image.patch [--flash-kb 1024|512]
+******************************************************************************
+"""
+import argparse
+import struct
+import sys
+
+APP_START = 0x08008000      # APP_START_BASE_ADDRESS
+FLASH_START = 0x08000000    # F4_SECTOR_0
+SECTOR_SIZES = [0x4000] * 4 + [0x10000] + [0x20000] * 7   # flash_sectors in boot.c (STM32F407VG)
+KEY_LENGTH = 16             # Bytes that must match before a copy is tried
+MIN_COPY = 16               # Shorter matches are inserted (a copy costs 9 bytes)
+CANDIDATES = 8              # Old positions kept per key
+HEADER_LENGTH = 16          # PATCH_HEADER_LENGTH
+OP_COPY = 0x01              # PATCH_OP_COPY
+OP_INSERT = 0x02            # PATCH_OP_INSERT
+BULK_HEADER_LENGTH = 12     # BL_BULK_HEADER_LENGTH, a bulk frame adds its end byte
+BULK_PAYLOAD_MAX = 1024     # BL_BULK_PAYLOAD_MAX
+
+
+def crc_table():
+    """Table of the MSB-first CRC-32/MPEG-2 (polynomial 0x04C11DB7)."""
+    table = []
+    for byte in range(256):
+        crc = byte << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x04C11DB7) if crc & 0x80000000 else (crc << 1)
+        table.append(crc & 0xFFFFFFFF)
+    return table
+
+
+CRC_TABLE = crc_table()
+
+
+def crc32_mpeg2(data):
+    """Byte-stream CRC-32/MPEG-2, as returned by TARGET_FLASH_CRC."""
+    crc = 0xFFFFFFFF
+    for byte in data:
+        crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ byte]
+    return crc
+
+
+def sector_starts(sector_count):
+    """Start offsets of the application sectors relative to APP_START, and the scratch limit."""
+    starts = []
+    address = FLASH_START
+    for size in SECTOR_SIZES[:sector_count]:
+        if address >= APP_START:
+            starts.append(address - APP_START)
+        address += size
+    return starts[:-1], starts[-1]  # The last sector is PATCH_SCRATCH_SECTOR
+
+
+def build_index(old):
+    """Old positions of every KEY_LENGTH-byte key at KEY_LENGTH-aligned offsets."""
+    index = {}
+    for pos in range(0, len(old) - KEY_LENGTH + 1, KEY_LENGTH):
+        candidates = index.setdefault(old[pos:pos + KEY_LENGTH], [])
+        if len(candidates) < CANDIDATES:
+            candidates.append(pos)
+    return index
+
+
+def match_length(old, new, source, pos, limit):
+    """Length of the common run of old[source:] and new[pos:limit]."""
+    end = min(limit - pos, len(old) - source)
+    length = 0
+    while (length + 256 <= end) and (old[source + length:source + length + 256] == new[pos + length:pos + length + 256]):
+        length += 256
+    while (length < end) and (old[source + length] == new[pos + length]):
+        length += 1
+    return length
+
+
+def encode(old, new, starts):
+    """Operation stream turning old into new under the sector constraint."""
+    index = build_index(old)
+    ops = bytearray()
+    pending = bytearray()
+    pos = 0
+    sector = 0
+    next_source = None
+
+    def flush_insert():
+        if pending:
+            ops.extend(struct.pack("<BI", OP_INSERT, len(pending)) + pending)
+            pending.clear()
+
+    while pos < len(new):
+        while (sector + 1 < len(starts)) and (pos >= starts[sector + 1]):
+            sector += 1
+        sector_start = starts[sector]
+        sector_end = starts[sector + 1] if sector + 1 < len(starts) else len(new)
+        limit = min(sector_end, len(new))
+
+        best_source, best_length = None, 0
+        candidates = [] if next_source is None else [next_source]  # Continue the last copy first
+        key = new[pos:pos + KEY_LENGTH]
+        if len(key) == KEY_LENGTH:
+            for aligned in index.get(key, []):
+                candidates.append(aligned)
+        for source in candidates:
+            if source < sector_start:
+                continue  # Old data before the output sector is already rewritten
+            length = match_length(old, new, source, pos, limit)
+            if length > best_length:
+                best_source, best_length = source, length
+
+        if best_length >= MIN_COPY:
+            back = 0
+            while (back < len(pending)) and (best_source - back - 1 >= sector_start) \
+                    and (pos - back - 1 >= sector_start) and (old[best_source - back - 1] == new[pos - back - 1]):
+                back += 1  # Take matching inserted bytes into the copy
+            if back:
+                del pending[len(pending) - back:]
+            flush_insert()
+            ops.extend(struct.pack("<BII", OP_COPY, best_source - back, best_length + back))
+            pos += best_length
+            next_source = best_source + best_length
+        else:
+            pending.append(new[pos])
+            pos += 1
+            next_source = next_source + 1 if next_source is not None else None
+    flush_insert()
+    return ops
+
+
+def wire_bytes(payload_length):
+    """Bytes sent in bulk frames of at most BULK_PAYLOAD_MAX payload bytes (raw link mode)."""
+    frames = (payload_length + BULK_PAYLOAD_MAX - 1) // BULK_PAYLOAD_MAX
+    return payload_length + frames * (BULK_HEADER_LENGTH + 1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compute a delta patch for TARGET_PATCH_DATA.")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("patch")
+    parser.add_argument("--flash-kb", type=int, choices=(1024, 512), default=1024,
+                        help="flash size: 1024 (STM32F407VG) or 512 (STM32F407VE)")
+    args = parser.parse_args()
+
+    with open(args.old, "rb") as f:
+        old = f.read()
+    with open(args.new, "rb") as f:
+        new = f.read()
+    starts, limit = sector_starts(12 if args.flash_kb == 1024 else 8)
+    if len(old) > limit or len(new) > limit or not new:
+        sys.exit("images must be 1..%d bytes: they end before the scratch sector" % limit)
+
+    ops = encode(old, new, starts)
+    header = struct.pack("<IIII", len(old), crc32_mpeg2(old), len(new), crc32_mpeg2(new))
+    with open(args.patch, "wb") as f:
+        f.write(header + ops)
+
+    print("new image %d bytes -> patch %d bytes; on the wire %d (TARGET_MEM_WRITE) vs %d (TARGET_PATCH_DATA)"
+          % (len(new), HEADER_LENGTH + len(ops), wire_bytes(len(new)), wire_bytes(len(ops))))
+
+
+if __name__ == "__main__":
+    main()
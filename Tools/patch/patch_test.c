@@ -0,0 +1,237 @@
+/*
+ ******************************************************************************
+ * @projectname    : Demo_Project_Parser
+ * @filename       : patch_test.c
+ * @author         : Omer Faruk ALMACI
+ * @date           : Oct 16, 2026
+ *
+ * @brief          : Host round trip of the delta patch
+ * @description    : Runs Core/Src/patch.c on the host against a simulated
+ *                   flash mapped at its real address (patch.c reads the old
+ *                   image and the scratch sector through pointers). The old
+ *                   image is placed at APP_START_BASE_ADDRESS, the patch made
+ *                   by patch.py is fed in TARGET_PATCH_DATA sized frames of
+ *                   random length, with some frames sent again from an
+ *                   earlier offset, and the flash is compared byte for byte
+ *                   with the new image. Programming only clears bits, as on
+ *                   the device: a write over data that was not erased fails.
+ *                   patch.c keeps addresses in uint32_t, so the test is built
+ *                   without PIE and holds its inputs in static buffers, which
+ *                   then lie below 4 GB like the simulated flash.
+ *
+ *                   gcc -no-pie -Ihost -I../../Core/Inc -o patch_test patch_test.c ../../Core/Src/patch.c
+ *                   ./patch.py old.bin new.bin image.patch && ./patch_test old.bin new.bin image.patch
+ ******************************************************************************
+ * @attention
+ *
+ * <h2><center>&copy; Copyright (c) 2024 Omer Faruk ALMACI.
+ * All rights reserved.</center></h2>
+ *
+ ******************************************************************************
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "boot.h"
+#include "write_buffer.h"
+#include "patch.h"
+/* Defines and Macros --------------------------------------------------------*/
+#define FLASH_BASE_ADDRESS (0x08000000UL)  // F4_SECTOR_0
+#define FLASH_SIZE (0x100000UL)            // FLASH_TOTAL_SIZE
+#define FRAME_PAYLOAD_MAX (1024)           // BL_BULK_PAYLOAD_MAX
+#define FILE_SIZE_MAX (0x200000UL)
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE MAP_FIXED
+#endif
+/* Variables -----------------------------------------------------------------*/
+const BL_Flash_Sector_t flash_sectors[TOTAL_SECTORS] = {
+	{ 0x08000000, 0x4000 }, { 0x08004000, 0x4000 }, { 0x08008000, 0x4000 }, { 0x0800C000, 0x4000 },
+	{ 0x08010000, 0x10000 }, { 0x08020000, 0x20000 }, { 0x08040000, 0x20000 }, { 0x08060000, 0x20000 },
+	{ 0x08080000, 0x20000 }, { 0x080A0000, 0x20000 }, { 0x080C0000, 0x20000 }, { 0x080E0000, 0x20000 },
+};
+static uint8_t *flash;
+static uint32_t erases[TOTAL_SECTORS];
+static uint32_t backups = 0;
+static uint32_t bad_programs = 0; // Writes that needed a 0->1 bit transition
+static uint8_t old_image[FILE_SIZE_MAX];
+static uint8_t new_image[FILE_SIZE_MAX];
+static uint8_t patch[FILE_SIZE_MAX];
+/* Functions -----------------------------------------------------------------*/
+
+static void flash_simulated_program(uint32_t address, const uint8_t *data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t *cell = &flash[address - FLASH_BASE_ADDRESS + i];
+		if ((*cell & data[i]) != data[i]) {
+			bad_programs++;
+		}
+		*cell &= data[i];
+	}
+}
+
+uint8_t flash_get_sector(uint32_t address) {
+	for (uint8_t sector = 0; sector < TOTAL_SECTORS; sector++) {
+		if ((address >= flash_sectors[sector].address)
+				&& (address - flash_sectors[sector].address < flash_sectors[sector].size)) {
+			return sector;
+		}
+	}
+	return INVALID_SECTOR_NUMBER;
+}
+
+uint8_t flash_erase(uint8_t sector_number, uint8_t number_of_sector) {
+	for (uint8_t sector = sector_number; sector < sector_number + number_of_sector; sector++) {
+		memset(&flash[flash_sectors[sector].address - FLASH_BASE_ADDRESS], 0xFF, flash_sectors[sector].size);
+		erases[sector]++;
+	}
+	return HAL_OK;
+}
+
+uint8_t flash_sector_backup(uint8_t sector, uint8_t scratch_sector, uint32_t len) {
+	static uint8_t copy[0x20000];
+
+	memcpy(copy, &flash[flash_sectors[sector].address - FLASH_BASE_ADDRESS], len);
+	flash_erase(scratch_sector, 1);
+	flash_simulated_program(flash_sectors[scratch_sector].address, copy, len);
+	backups++;
+	return HAL_OK;
+}
+
+uint8_t flash_sector_rewrite(uint8_t sector, const uint8_t *data, uint32_t len) {
+	const uint8_t *old = &flash[flash_sectors[sector].address - FLASH_BASE_ADDRESS];
+
+	for (uint32_t i = 0; i < len; i++) {
+		if ((old[i] & data[i]) != data[i]) { // As mem_write_diff(): erase only for a 0->1 transition
+			flash_erase(sector, 1);
+			break;
+		}
+	}
+	flash_simulated_program(flash_sectors[sector].address, data, len);
+	return HAL_OK;
+}
+
+uint8_t write_buffer_write(const uint8_t *data, uint32_t address, uint32_t len) {
+	uint8_t *copy = malloc(len); // data may point into the simulated flash
+
+	memcpy(copy, data, len);
+	flash_simulated_program(address, copy, len);
+	free(copy);
+	return HAL_OK;
+}
+
+uint8_t write_buffer_flush(void) {
+	return HAL_OK;
+}
+
+static uint32_t crc32_stream(const uint8_t *data, uint32_t len) {
+	uint32_t crc = 0xFFFFFFFFUL;
+
+	for (uint32_t i = 0; i < len; i++) {
+		crc ^= (uint32_t) data[i] << 24;
+		for (uint8_t bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80000000UL) ? (crc << 1) ^ 0x04C11DB7UL : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint8_t flash_region_crc(uint32_t address, uint32_t len, uint32_t *crc) {
+	*crc = crc32_stream(&flash[address - FLASH_BASE_ADDRESS], len);
+	return HAL_OK;
+}
+
+static uint32_t read_file(const char *path, uint8_t *data) {
+	FILE *f = fopen(path, "rb");
+	size_t size;
+
+	if (f == NULL) {
+		perror(path);
+		exit(2);
+	}
+	size = fread(data, 1, FILE_SIZE_MAX, f);
+	if (!feof(f) || ferror(f)) {
+		fprintf(stderr, "%s: not readable or larger than %lu bytes\n", path, FILE_SIZE_MAX);
+		exit(2);
+	}
+	fclose(f);
+	return (uint32_t) size;
+}
+
+int main(int argc, char **argv) {
+	uint32_t old_len, new_len, patch_len, offset = PATCH_HEADER_LENGTH, frames = 0, resent = 0;
+	uint8_t status;
+
+	if (argc != 4) {
+		fprintf(stderr, "usage: %s old.bin new.bin image.patch\n", argv[0]);
+		return 2;
+	}
+	old_len = read_file(argv[1], old_image);
+	new_len = read_file(argv[2], new_image);
+	patch_len = read_file(argv[3], patch);
+	if ((patch_len < PATCH_HEADER_LENGTH) || (old_len > FLASH_SIZE - (APP_START_BASE_ADDRESS - FLASH_BASE_ADDRESS))) {
+		fprintf(stderr, "bad input sizes\n");
+		return 2;
+	}
+	flash = mmap((void*) FLASH_BASE_ADDRESS, FLASH_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (flash != (uint8_t*) FLASH_BASE_ADDRESS) {
+		perror("mmap at the flash address");
+		return 2;
+	}
+	memset(flash, 0xFF, FLASH_SIZE);
+	memcpy(&flash[APP_START_BASE_ADDRESS - FLASH_BASE_ADDRESS], old_image, old_len);
+	srand(1);
+
+	status = patch_start(patch, PATCH_HEADER_LENGTH);
+	if (status != HAL_OK) {
+		printf("FAIL: patch_start returned %u\n", status);
+		return 1;
+	}
+	while (offset < patch_len) {
+		uint32_t stream_offset = offset - PATCH_HEADER_LENGTH;
+		uint32_t len = 1 + (uint32_t) rand() % FRAME_PAYLOAD_MAX;
+		uint32_t start = stream_offset;
+
+		if (len > patch_len - offset) {
+			len = patch_len - offset;
+		}
+		if ((stream_offset > 16) && (rand() % 8 == 0)) {
+			start -= 1 + (uint32_t) rand() % 16; // Resent frame: the consumed part is skipped
+			resent++;
+		}
+		status = patch_feed(&patch[PATCH_HEADER_LENGTH + start], start, stream_offset + len - start);
+		if (status != HAL_OK) {
+			printf("FAIL: patch_feed returned %u at offset %u (produced %u, sector %u)\n", status, stream_offset,
+					patch_progress.produced, patch_progress.sector);
+			return 1;
+		}
+		offset += len;
+		frames++;
+	}
+
+	if (patch_progress.state != PATCH_DONE) {
+		printf("FAIL: state %u after the whole patch\n", patch_progress.state);
+		return 1;
+	}
+	if (memcmp(&flash[APP_START_BASE_ADDRESS - FLASH_BASE_ADDRESS], new_image, new_len) != 0) {
+		printf("FAIL: flash differs from the new image\n");
+		return 1;
+	}
+	if (bad_programs != 0) {
+		printf("FAIL: %u bytes programmed over data that was not erased\n", bad_programs);
+		return 1;
+	}
+	printf("OK: %u bytes rebuilt from a %u byte patch in %u frames (%u resent), %u sectors started\n", new_len,
+			patch_len, frames, resent, patch_progress.sectors);
+	printf("erases per sector:");
+	for (uint8_t sector = APP_START_SECTOR; sector < TOTAL_SECTORS; sector++) {
+		printf(" %u", erases[sector]);
+	}
+	printf(" (last: scratch), %u scratch backups\n", backups);
+
+	return 0;
+}
+
+/************************ (C) COPYRIGHT Omer Faruk ALMACI *****END OF FILE****/
@@ -62,6 +62,9 @@
  */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+#define RX_PACKET_SIZE  CDC_DATA_FS_OUT_PACKET_SIZE
+#define RX_PACKET_COUNT (APP_RX_DATA_SIZE / RX_PACKET_SIZE) // OUT buffers carved from UserRxBufferFS
+#define TX_RING_MASK    (APP_TX_DATA_SIZE - 1)              // UserTxBufferFS is the TX ring, size is a power of two
 /* USER CODE END PRIVATE_DEFINES */
 
 /**
@@ -74,6 +77,7 @@
  */
 
 /* USER CODE BEGIN PRIVATE_MACRO */
+#define RX_PACKET(n) (&UserRxBufferFS[((n) % RX_PACKET_COUNT) * RX_PACKET_SIZE])
 
 /* USER CODE END PRIVATE_MACRO */
 
@@ -94,6 +98,23 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+static volatile uint16_t rx_packet_len[RX_PACKET_COUNT]; // Length of each received packet
+static volatile uint32_t rx_write = 0;     // Packets received (free running), advanced by CDC_Receive_FS
+static volatile uint32_t rx_read = 0;      // Packet holding the next unconsumed byte (free running), advanced by CDC_RxSkip_FS
+static volatile uint32_t rx_free = 0;      // Packets released (free running), advanced by CDC_RxRelease_FS
+static volatile uint32_t rx_bytes_in = 0;  // Bytes received (free running)
+static volatile uint32_t rx_bytes_out = 0; // Bytes consumed (free running)
+static uint32_t rx_bytes_free = 0;         // Bytes of the released packets (free running)
+static uint32_t rx_offset = 0;             // Bytes of packet rx_read already consumed
+static volatile uint8_t rx_stalled = 0;    // No free buffer: the endpoint is not armed and the host is NAKed
+static volatile uint32_t rx_session = 0;   // Stream position where the current host session starts, set by CDC_Init_FS
+static volatile uint32_t rx_generation = 0; // Incremented by CDC_Init_FS, see CDC_RxGeneration_FS
+static uint8_t rx_spare[RX_PACKET_SIZE];   // Armed by CDC_Init_FS while every buffer is in use
+static volatile uint32_t rx_spare_len = 0; // Length of the packet waiting in rx_spare for a free buffer
+static volatile uint32_t port_opens = 0;   // SET_CONTROL_LINE_STATE requests, see CDC_PortOpens_FS
+static volatile uint32_t tx_head = 0;      // Bytes queued (free running), advanced by CDC_Queue_FS
+static volatile uint32_t tx_tail = 0;      // Bytes sent (free running), advanced by CDC_TransmitCplt_FS
+static volatile uint32_t tx_inflight = 0;  // Length of the running IN transfer, 0 if idle
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -128,6 +149,8 @@ static int8_t CDC_Receive_FS(uint8_t *pbuf, uint32_t *Len);
 static int8_t CDC_TransmitCplt_FS(uint8_t *pbuf, uint32_t *Len, uint8_t epnum);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static void CDC_TxStart_FS(void);
+static void CDC_RxArm_FS(void);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -147,7 +170,16 @@ static int8_t CDC_Init_FS(void) {
 	/* USER CODE BEGIN 3 */
 	/* Set Application Buffers */
 	USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
-	USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+	// The parser may be using the OUT buffers right now, so the ring is not reset here:
+	// the main loop sees the new generation and drops the bytes before rx_session
+	// (parser_reset). The class arms the endpoint on the buffer set here in any case;
+	// if every buffer is in use that is rx_spare, moved to the ring once one is released.
+	rx_session = rx_bytes_in;
+	rx_generation++;
+	rx_spare_len = 0; // A packet of the previous session
+	tx_inflight = 0; // A bus reset aborted the running transfer, CDC_TxRetry_FS() sends the ring again
+	rx_stalled = 0;
+	USBD_CDC_SetRxBuffer(&hUsbDeviceFS, (rx_write - rx_free < RX_PACKET_COUNT) ? RX_PACKET(rx_write) : rx_spare);
 	return (USBD_OK);
 	/* USER CODE END 3 */
 }
@@ -218,7 +250,7 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t *pbuf, uint16_t length) {
 		break;
 
 	case CDC_SET_CONTROL_LINE_STATE:
-
+		port_opens++; // The main loop resets the link mode and the response cache
 		break;
 
 	case CDC_SEND_BREAK:
@@ -250,20 +282,20 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t *pbuf, uint16_t length) {
  */
 static int8_t CDC_Receive_FS(uint8_t *Buf, uint32_t *Len) {
 	/* USER CODE BEGIN 6 */
-	USBD_CDC_SetRxBuffer(&hUsbDeviceFS, &Buf[0]);
-	USBD_CDC_ReceivePacket(&hUsbDeviceFS);
-
-	memset(buffer_rx, '\0', 30);  // clear the buffer
-	uint8_t len = (uint8_t) *Len;
-	if (len < 31) {
-
-		memcpy(buffer_rx, Buf, len);  // copy the data to the buffer
-		memset(Buf, '\0', len);
-
-		if (m_device.message_state == WAIT_FOR_MESSAGE) {
-			parse_message(buffer_rx, len);
-		}
+	// The packet stays in its buffer until the parser releases it (CDC_RxRelease_FS):
+	// frames are parsed in place. The endpoint is re-armed at once on the next buffer;
+	// if every buffer is still in use it stays NAKed until one is released, so no
+	// packet is overwritten.
+	if (Buf == rx_spare) {
+		rx_spare_len = *Len; // Armed by CDC_Init_FS while the ring was full
+	} else {
+		rx_packet_len[rx_write % RX_PACKET_COUNT] = (uint16_t) *Len; // Buf is RX_PACKET(rx_write)
+		rx_bytes_in += *Len;
+		rx_write++;
 	}
+	CDC_RxArm_FS();
+
+	m_device.comm_state.last_rx_time = 0; // Resets the device's communication control counter when any data communication occurs.
 
 	return (USBD_OK);
 	/* USER CODE END 6 */
@@ -285,6 +317,9 @@ uint8_t CDC_Transmit_FS(uint8_t *Buf, uint16_t Len) {
 	/* USER CODE BEGIN 7 */
 	USBD_CDC_HandleTypeDef *hcdc =
 			(USBD_CDC_HandleTypeDef*) hUsbDeviceFS.pClassData;
+	if ((hcdc == NULL) || (hUsbDeviceFS.dev_state != USBD_STATE_CONFIGURED)) {
+		return USBD_FAIL;
+	}
 	if (hcdc->TxState != 0) {
 		return USBD_BUSY;
 	}
@@ -312,12 +347,301 @@ static int8_t CDC_TransmitCplt_FS(uint8_t *Buf, uint32_t *Len, uint8_t epnum) {
 	UNUSED(Buf);
 	UNUSED(Len);
 	UNUSED(epnum);
+	tx_tail += tx_inflight;
+	tx_inflight = 0;
+	CDC_TxStart_FS(); // Everything queued meanwhile goes out in one transfer
 	/* USER CODE END 13 */
 	return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
+/**
+ * @brief  CDC_TxStart_FS
+ *         Starts an IN transfer with every queued byte up to the end of the ring.
+ *         Responses queued while a transfer runs are coalesced into full packets.
+ * @note   Called with the USB interrupt masked or from it.
+ * @retval None
+ */
+static void CDC_TxStart_FS(void) {
+	uint32_t pending = tx_head - tx_tail;
+	uint32_t start = tx_tail & TX_RING_MASK;
+
+	if ((tx_inflight != 0) || (pending == 0)) {
+		return;
+	}
+	if (pending > APP_TX_DATA_SIZE - start) {
+		pending = APP_TX_DATA_SIZE - start; // The rest follows from the start of the ring
+	}
+	if (CDC_Transmit_FS(&UserTxBufferFS[start], (uint16_t) pending) == USBD_OK) {
+		tx_inflight = pending;
+	}
+}
+
+/**
+ * @brief  CDC_RxArm_FS
+ *         Moves a packet waiting in rx_spare to the ring and arms the endpoint on the
+ *         next buffer, or leaves it NAKed (rx_stalled) while no buffer is free.
+ * @note   Called with the USB interrupt masked or from it.
+ * @retval None
+ */
+static void CDC_RxArm_FS(void) {
+	if ((rx_spare_len != 0) && (rx_write - rx_free < RX_PACKET_COUNT)) {
+		memcpy(RX_PACKET(rx_write), rx_spare, rx_spare_len);
+		rx_packet_len[rx_write % RX_PACKET_COUNT] = (uint16_t) rx_spare_len;
+		rx_bytes_in += rx_spare_len;
+		rx_write++;
+		rx_spare_len = 0;
+	}
+	if ((rx_spare_len == 0) && (rx_write - rx_free < RX_PACKET_COUNT)) {
+		rx_stalled = 0;
+		USBD_CDC_SetRxBuffer(&hUsbDeviceFS, RX_PACKET(rx_write));
+		USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+	} else {
+		rx_stalled = 1;
+	}
+}
+
+/**
+ * @brief  CDC_Queue_FS
+ *         Queues data to be sent over the USB IN endpoint and returns without
+ *         waiting. The data is sent from CDC_TransmitCplt_FS when the endpoint is busy.
+ * @param  Buf: Data to be sent
+ * @param  Len: Number of bytes
+ * @retval USBD_OK if the data was queued, USBD_BUSY if the TX ring has no room for it
+ */
+uint8_t CDC_Queue_FS(const uint8_t *Buf, uint16_t Len) {
+	uint32_t head = tx_head;
+
+	if (Len > CDC_TxFree_FS()) {
+		return USBD_BUSY;
+	}
+	for (uint32_t i = 0; i < Len; i++) {
+		UserTxBufferFS[(head + i) & TX_RING_MASK] = Buf[i];
+	}
+	tx_head = head + Len;
+
+	__disable_irq(); // CDC_TransmitCplt_FS must not finish between the check and the start
+	CDC_TxStart_FS();
+	__enable_irq();
+
+	return USBD_OK;
+}
+
+/**
+ * @brief  CDC_TxRetry_FS
+ *         Starts the IN transfer again when queued bytes are not being sent, e.g. because
+ *         CDC_Transmit_FS failed while the device was not configured or after a bus reset.
+ * @note   Called from the main loop.
+ * @retval None
+ */
+void CDC_TxRetry_FS(void) {
+	if ((tx_inflight != 0) || (tx_head == tx_tail)) {
+		return;
+	}
+
+	__disable_irq();
+	CDC_TxStart_FS();
+	__enable_irq();
+}
+
+/**
+ * @brief  CDC_TxFree_FS
+ *         Number of bytes the TX ring can still take.
+ * @retval Number of bytes
+ */
+uint32_t CDC_TxFree_FS(void) {
+	return APP_TX_DATA_SIZE - (tx_head - tx_tail);
+}
+
+/**
+ * @brief  CDC_TxIdle_FS
+ *         Whether every queued byte has been taken by the host.
+ * @retval 1 if the TX ring is empty and no IN transfer is running, 0 otherwise
+ */
+uint8_t CDC_TxIdle_FS(void) {
+	return (tx_head == tx_tail) && (tx_inflight == 0);
+}
+
+/**
+ * @brief  CDC_RxCount_FS
+ *         Number of received bytes not consumed yet.
+ * @retval Number of bytes
+ */
+uint32_t CDC_RxCount_FS(void) {
+	return rx_bytes_in - rx_bytes_out;
+}
+
+/**
+ * @brief  CDC_RxFree_FS
+ *         Number of bytes the free OUT buffers can still take.
+ * @retval Number of bytes
+ */
+uint32_t CDC_RxFree_FS(void) {
+	return (RX_PACKET_COUNT - (rx_write - rx_free)) * RX_PACKET_SIZE;
+}
+
+/**
+ * @brief  CDC_RxPosition_FS
+ *         Stream position of the next unconsumed byte, for CDC_RxRelease_FS.
+ * @retval Bytes consumed since the port was initialised (free running)
+ */
+uint32_t CDC_RxPosition_FS(void) {
+	return rx_bytes_out;
+}
+
+/**
+ * @brief  CDC_RxPeek_FS
+ *         Returns the oldest unconsumed bytes in place, without copying them. This is
+ *         possible when they lie in consecutive buffers, all but the last one full, and
+ *         do not wrap around the end of UserRxBufferFS: the usual case, since a host
+ *         write arrives as full packets followed by one short packet.
+ * @param  len: Number of bytes, at most CDC_RxCount_FS()
+ * @retval Pointer to the bytes, valid until they are released; NULL if not contiguous
+ */
+uint8_t* CDC_RxPeek_FS(uint32_t len) {
+	uint32_t packet = rx_read;
+	uint32_t avail = rx_packet_len[packet % RX_PACKET_COUNT] - rx_offset;
+
+	while (avail < len) {
+		if ((rx_packet_len[packet % RX_PACKET_COUNT] != RX_PACKET_SIZE)
+				|| ((packet + 1) % RX_PACKET_COUNT == 0)) {
+			return NULL; // Short packet or ring wrap before the end of the bytes
+		}
+		packet++;
+		avail += rx_packet_len[packet % RX_PACKET_COUNT];
+	}
+
+	return RX_PACKET(rx_read) + rx_offset;
+}
+
+/**
+ * @brief  CDC_RxFind_FS
+ *         Searches the unconsumed bytes for a value, without copying them.
+ * @param  value: Byte to look for
+ * @param  start: Offset of the first byte to search from the next unconsumed byte
+ * @param  len: Number of bytes to search, start + len at most CDC_RxCount_FS()
+ * @retval Offset of the first match from the next unconsumed byte, CDC_RX_NOT_FOUND if none
+ */
+uint32_t CDC_RxFind_FS(uint8_t value, uint32_t start, uint32_t len) {
+	uint32_t packet = rx_read;
+	uint32_t offset = rx_offset + start;
+	uint32_t index = start;
+
+	if (len == 0) {
+		return CDC_RX_NOT_FOUND;
+	}
+	while (offset >= rx_packet_len[packet % RX_PACKET_COUNT]) {
+		offset -= rx_packet_len[packet % RX_PACKET_COUNT];
+		packet++;
+	}
+	while (index < start + len) {
+		const uint8_t *data = RX_PACKET(packet);
+		uint32_t end = rx_packet_len[packet % RX_PACKET_COUNT];
+		for (; (offset < end) && (index < start + len); offset++, index++) {
+			if (data[offset] == value) {
+				return index;
+			}
+		}
+		packet++;
+		offset = 0;
+	}
+
+	return CDC_RX_NOT_FOUND;
+}
+
+/**
+ * @brief  CDC_RxCopy_FS
+ *         Copies the oldest unconsumed bytes without consuming them.
+ * @param  dest: Destination buffer
+ * @param  len: Number of bytes to copy, at most CDC_RxCount_FS()
+ * @retval None
+ */
+void CDC_RxCopy_FS(uint8_t *dest, uint32_t len) {
+	uint32_t packet = rx_read;
+	uint32_t offset = rx_offset;
+
+	while (len > 0) {
+		uint32_t chunk = rx_packet_len[packet % RX_PACKET_COUNT] - offset;
+		if (chunk > len) {
+			chunk = len;
+		}
+		memcpy(dest, RX_PACKET(packet) + offset, chunk);
+		dest += chunk;
+		len -= chunk;
+		packet++;
+		offset = 0;
+	}
+}
+
+/**
+ * @brief  CDC_RxSkip_FS
+ *         Consumes received bytes. Their buffers stay in use until CDC_RxRelease_FS(),
+ *         so bytes returned by CDC_RxPeek_FS() remain valid.
+ * @param  len: Number of bytes to consume, at most CDC_RxCount_FS()
+ * @retval None
+ */
+void CDC_RxSkip_FS(uint32_t len) {
+	rx_bytes_out += len;
+	len += rx_offset;
+	while ((rx_read != rx_write) && (len >= rx_packet_len[rx_read % RX_PACKET_COUNT])) {
+		len -= rx_packet_len[rx_read % RX_PACKET_COUNT];
+		rx_read++;
+	}
+	rx_offset = len;
+}
+
+/**
+ * @brief  CDC_RxRelease_FS
+ *         Releases the buffers whose bytes all lie before a stream position, and
+ *         re-arms the endpoint if it was waiting for a free buffer.
+ * @param  position: Stream position (CDC_RxPosition_FS()) of the oldest byte still in use
+ * @retval None
+ */
+void CDC_RxRelease_FS(uint32_t position) {
+	while ((rx_free != rx_read) && ((int32_t) (position - (rx_bytes_free + rx_packet_len[rx_free % RX_PACKET_COUNT])) >= 0)) {
+		rx_bytes_free += rx_packet_len[rx_free % RX_PACKET_COUNT];
+		rx_free++;
+	}
+
+	__disable_irq(); // CDC_Receive_FS must not set rx_stalled between the check and the re-arm
+	if (rx_stalled) {
+		CDC_RxArm_FS();
+	}
+	__enable_irq();
+}
+
+/**
+ * @brief  CDC_RxGeneration_FS
+ *         Number of times the port was initialised (CDC_Init_FS). A change tells the
+ *         main loop that the bytes before CDC_RxSession_FS() belong to an earlier host
+ *         session and must be dropped.
+ * @retval Generation (free running)
+ */
+uint32_t CDC_RxGeneration_FS(void) {
+	return rx_generation;
+}
+
+/**
+ * @brief  CDC_RxSession_FS
+ *         Stream position of the first byte received in the current host session.
+ * @retval Stream position (CDC_RxPosition_FS() units)
+ */
+uint32_t CDC_RxSession_FS(void) {
+	return rx_session;
+}
+
+/**
+ * @brief  CDC_PortOpens_FS
+ *         Number of SET_CONTROL_LINE_STATE requests, sent by a host opening the port.
+ *         A change tells the main loop that a new host session starts in
+ *         LINK_MODE_RAW and with a new command numbering.
+ * @retval Count (free running)
+ */
+uint32_t CDC_PortOpens_FS(void) {
+	return port_opens;
+}
+
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
 /**
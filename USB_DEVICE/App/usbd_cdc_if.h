@@ -51,6 +51,7 @@
 #define APP_RX_DATA_SIZE  2048
 #define APP_TX_DATA_SIZE  2048
 /* USER CODE BEGIN EXPORTED_DEFINES */
+#define CDC_RX_NOT_FOUND  0xFFFFFFFFU /* CDC_RxFind_FS: value not in the searched bytes */
 
 /* USER CODE END EXPORTED_DEFINES */
 
@@ -108,6 +109,21 @@ extern USBD_CDC_ItfTypeDef USBD_Interface_fops_FS;
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
+uint8_t CDC_Queue_FS(const uint8_t* Buf, uint16_t Len);
+uint32_t CDC_TxFree_FS(void);
+uint8_t CDC_TxIdle_FS(void);
+void CDC_TxRetry_FS(void);
+uint32_t CDC_RxCount_FS(void);
+uint32_t CDC_RxFree_FS(void);
+uint32_t CDC_RxPosition_FS(void);
+uint8_t* CDC_RxPeek_FS(uint32_t len);
+uint32_t CDC_RxFind_FS(uint8_t value, uint32_t start, uint32_t len);
+void CDC_RxCopy_FS(uint8_t* dest, uint32_t len);
+void CDC_RxSkip_FS(uint32_t len);
+void CDC_RxRelease_FS(uint32_t position);
+uint32_t CDC_RxGeneration_FS(void);
+uint32_t CDC_RxSession_FS(void);
+uint32_t CDC_PortOpens_FS(void);
 
 /* USER CODE END EXPORTED_FUNCTIONS */
 